@@ -44,14 +44,116 @@ extern void   OSA_exit( int code );
  */
 extern void   OSA_delay( UINT32 msecs );
 
+/**
+ * @brief 操作系统微秒延时，延时到基于CLOCK_MONOTONIC的绝对时刻，不受信号中断的影响。
+ * @param usecs - 延时的计数，单位为微秒。
+ * @return	无。
+ */
+extern void   OSA_delayUs( UINT32 usecs );
+
+/**
+ * @brief 操作系统纳秒延时，延时到基于CLOCK_MONOTONIC的绝对时刻，不受信号中断的影响。
+ * @param nsecs - 延时的计数，单位为纳秒。
+ * @return	无。
+ */
+extern void   OSA_delayNs( UINT64 nsecs );
+
+/**
+ * @brief 获取CLOCK_MONOTONIC时间，不受系统时间调整的影响。
+ * @return	时间，单位纳秒。
+ */
+extern UINT64 OSA_nowNs( void );
+
+/**
+ * @brief 获取快速时间戳，开销为几纳秒。
+ *        x86_64上使用不变的TSC，arm64上使用通用定时器计数，否则使用OSA_nowNs。
+ *        首次调用需要校准10毫秒，OSA_init中已完成校准。之后不再校准，
+ *        NTP调整CLOCK_MONOTONIC的速率时会与OSA_nowNs产生漂移，因此不能与
+ *        OSA_nowNs的时间比较或混用，只适用于两次OSA_fastNs之间的时间间隔，
+ *        不适用于计算等待的截止时间。
+ * @return	时间，单位纳秒。
+ */
+extern UINT64 OSA_fastNs( void );
+
+/**
+ * @brief 获取内核缓存的粗粒度CLOCK_MONOTONIC时间，不读取硬件计数，
+ *        精度为一个调度时钟节拍，适用于日志时间戳等热点路径。
+ * @return	时间，单位纳秒。
+ */
+extern UINT64 OSA_coarseNs( void );
+
+#define DEADLINE_NO_WAIT 0ULL    /**< 截止时间定义 - 不等待 */
+#define DEADLINE_FOREVER (~0ULL) /**< 截止时间定义 - 无限等待 */
+
+/**
+ * @brief 将等待时间转换为绝对截止时间，供xxxUntil系列等待函数使用。
+ *        截止时间基于CLOCK_MONOTONIC，不受系统时间调整和NTP校时的影响，
+ *        多次等待可以共用同一个截止时间，虚假唤醒不会延长等待。
+ * @param tminms - 等待时间，单位毫秒，0 - 不等待，-1 - 无限等待，>0 - 计时等待。
+ * @return	截止时间，单位纳秒，DEADLINE_NO_WAIT或DEADLINE_FOREVER。
+ */
+extern UINT64 OSA_deadline( int tminms );
+
+#define OSA_SPIN_DEFAULT 2000 /**< 自适应等待的缺省自旋次数，单CPU系统中不自旋 */
+
+/**
+ * @brief 自适应等待的自旋统计信息。
+ */
+typedef struct OSA_SPIN_STATS
+{
+	UINT64    spins; /**< 进入自旋的次数 */
+	UINT64 spinHits; /**< 自旋期间等到对象的次数 */
+	UINT64   blocks; /**< 自旋后仍然进入睡眠等待的次数 */
+}
+OSA_SPIN_STATS;
+
+#define OSA_MAX_CPUS 64 /**< CPU集合(UINT64位图)支持的最大CPU数量 */
+
+/**
+ * @brief CPU拓扑信息，CPU集合的第n位对应第n个CPU。
+ */
+typedef struct OSA_CPU_TOPOLOGY
+{
+	int                 nCpus; /**< 在线CPU的数量 */
+	UINT64             online; /**< 在线CPU集合 */
+	UINT64           isolated; /**< 由isolcpus=隔离的CPU集合 */
+	UINT64           nohzFull; /**< 由nohz_full=设置为无时钟节拍的CPU集合 */
+	int  coreId[OSA_MAX_CPUS]; /**< 各CPU的物理核编号，-1 - 未知 */
+	int packageId[OSA_MAX_CPUS]; /**< 各CPU的物理封装编号，-1 - 未知 */
+}
+OSA_CPU_TOPOLOGY;
+
+/**
+ * @brief 从sysfs获取CPU拓扑和隔离的CPU，可在OSA_init的初始化回调函数中
+ *        为关键任务选择独占的CPU。
+ * @param topo - CPU拓扑信息的返回地址。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS OSA_getCpuTopology( OSA_CPU_TOPOLOGY *topo );
+
 /* Event interface */
 
+#define EVENT_OPT_ADAPTIVE 0x01 /**< 自适应等待，先自旋再睡眠 */
+#define EVENT_OPT_MANUAL   0x02 /**< 手动复位，设置后唤醒全部等待任务，直到清除 */
+
 /**
  * @brief 创建操作系统事件对象。
  * @return	事件对象句柄，NULL - 失败。
  */
 extern HANDLE eventCreate( void );
 
+/**
+ * @brief 按指定的选项创建操作系统事件对象。
+ *        - EVENT_OPT_ADAPTIVE选项使等待任务先自旋检查事件，在自旋次数内未等到
+ *          时再睡眠，适用于绑定在独占CPU上的任务之间的快速交接。
+ *        - EVENT_OPT_MANUAL选项的事件在等待成功后不自动清除，eventSet一次唤醒
+ *          全部等待任务，直到eventClear清除后新的等待任务才会等待。
+ * @param options - 选项，EVENT_OPT_XXX的组合。
+ * @param spin - 自旋次数，0 - 使用OSA_SPIN_DEFAULT。
+ * @return	事件对象句柄，NULL - 失败。
+ */
+extern HANDLE eventCreateEx( int options, int spin );
+
 /**
  * @brief 删除操作系统事件对象。
  * @param handle - 事件对象句柄。
@@ -67,6 +169,15 @@ extern void   eventDelete( HANDLE handle );
  */
 extern STATUS eventWait( HANDLE handle, int tminms );
 
+/**
+ * @brief 在截止时间之前等待操作系统事件对象。
+ * @param handle - 事件对象句柄。
+ * @param deadline - 由OSA_deadline得到的截止时间，DEADLINE_NO_WAIT - 不等待，
+ *                   DEADLINE_FOREVER - 无限等待。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS eventWaitUntil( HANDLE handle, UINT64 deadline );
+
 /**
  * @brief 设置操作系统事件对象，即发事件信号。
  * @param handle - 事件对象句柄。
@@ -74,6 +185,14 @@ extern STATUS eventWait( HANDLE handle, int tminms );
  */
 extern STATUS eventSet( HANDLE handle );
 
+/**
+ * @brief 一次唤醒当前等待操作系统事件对象的全部任务，事件本身保持不变，
+ *        之后到来的等待任务仍然等待。
+ * @param handle - 事件对象句柄。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS eventPulse( HANDLE handle );
+
 /**
  * @brief 清除操作系统事件对象。
  * @param handle - 事件对象句柄。
@@ -88,14 +207,107 @@ extern void   eventClear( HANDLE handle );
  */
 extern BOOL   eventIsSet( HANDLE handle );
 
+/**
+ * @brief 获取自适应事件对象的自旋统计信息。
+ * @param handle - 事件对象句柄。
+ * @param stats - 统计信息的返回地址。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS eventGetSpinStats( HANDLE handle, OSA_SPIN_STATS *stats );
+
+/* Event group interface */
+
+#define EVENT_WAIT_ANY 0 /**< 等待任意一个事件位 */
+#define EVENT_WAIT_ALL 1 /**< 等待全部事件位 */
+
+/**
+ * @brief 创建操作系统事件组对象，包含32个事件位，初始全部清除。
+ * @return	事件组对象句柄，NULL - 失败。
+ */
+extern HANDLE eventGroupCreate( void );
+
+/**
+ * @brief 删除操作系统事件组对象。
+ * @param handle - 事件组对象句柄。
+ * @return	无。
+ */
+extern void   eventGroupDelete( HANDLE handle );
+
+/**
+ * @brief 设置事件组的事件位，唤醒等待该事件组的任务检查各自的条件。
+ * @param handle - 事件组对象句柄。
+ * @param bits - 要设置的事件位。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS eventSetBits( HANDLE handle, UINT32 bits );
+
+/**
+ * @brief 清除事件组的事件位。
+ * @param handle - 事件组对象句柄。
+ * @param bits - 要清除的事件位。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS eventClearBits( HANDLE handle, UINT32 bits );
+
+/**
+ * @brief 获取事件组当前的事件位。
+ * @param handle - 事件组对象句柄。
+ * @return	当前设置的事件位。
+ */
+extern UINT32 eventGetBits( HANDLE handle );
+
+/**
+ * @brief 等待事件组的事件位。
+ * @param handle - 事件组对象句柄。
+ * @param mask - 等待的事件位。
+ * @param mode - EVENT_WAIT_ANY - 任意一位设置即满足，EVENT_WAIT_ALL - 全部设置才满足。
+ * @param clearOnExit - 满足时是否同时清除mask中的事件位。
+ * @param tminms - 等待时间，单位毫秒，0 - 不等待，-1 - 无限等待，>0 - 计时等待。
+ * @return	满足时mask中已设置的事件位，0 - 超时或失败。
+ */
+extern UINT32 eventWaitBits( HANDLE handle, UINT32 mask, int mode, BOOL clearOnExit, int tminms );
+
+/**
+ * @brief 在截止时间之前等待事件组的事件位。
+ * @param handle - 事件组对象句柄。
+ * @param mask - 等待的事件位。
+ * @param mode - EVENT_WAIT_ANY或EVENT_WAIT_ALL。
+ * @param clearOnExit - 满足时是否同时清除mask中的事件位。
+ * @param deadline - 由OSA_deadline得到的截止时间，DEADLINE_NO_WAIT - 不等待，
+ *                   DEADLINE_FOREVER - 无限等待。
+ * @return	满足时mask中已设置的事件位，0 - 超时或失败。
+ */
+extern UINT32 eventWaitBitsUntil( HANDLE handle, UINT32 mask, int mode, BOOL clearOnExit, UINT64 deadline );
+
 /* Mutex interface */
 
+#define MUTEX_OPT_ADAPTIVE  0x01 /**< 自适应等待，先自旋再睡眠 */
+#define MUTEX_OPT_INHERIT   0x02 /**< 优先级继承，避免无界的优先级反转 */
+#define MUTEX_OPT_RECURSIVE 0x04 /**< 允许持有者重复加锁 */
+#define MUTEX_OPT_ROBUST    0x08 /**< 持有者退出后由下一个加锁任务获得 */
+#define MUTEX_OPT_ADAPTIVE_NP 0x10 /**< 使用glibc的自适应互斥体，不能与MUTEX_OPT_RECURSIVE同时使用 */
+
 /**
  * @brief 创建操作系统互斥体对象。
  * @return	互斥体对象句柄，NULL - 失败。
  */
 extern HANDLE mutexCreate( void );
 
+/**
+ * @brief 按指定的选项创建操作系统互斥体对象。
+ *        - MUTEX_OPT_INHERIT选项使持有者继承等待任务中的最高优先级，
+ *          不同优先级的SCHED_FIFO任务共享的互斥体应使用该选项。
+ *        - MUTEX_OPT_ADAPTIVE选项使加锁任务先自旋重试，在自旋次数内未获得时再睡眠。
+ *        - MUTEX_OPT_RECURSIVE选项允许持有者重复加锁，解锁次数必须与加锁次数相同。
+ *        - MUTEX_OPT_ROBUST选项使持有者退出后，下一个加锁任务获得该互斥体，
+ *          被保护数据的一致性由该任务负责，该任务可由mutexOwnerDied得知。
+ *        - MUTEX_OPT_ADAPTIVE_NP选项使用glibc的自适应互斥体，由glibc自旋，没有自旋统计信息。
+ * @param options - 选项，MUTEX_OPT_XXX的组合。
+ * @param spin - 自旋次数，0 - 使用OSA_SPIN_DEFAULT。
+ * @return	互斥体对象句柄，NULL - 失败。
+ */
+extern HANDLE mutexCreateEx( int options, int spin );
+
 /**
  * @brief 删除操作系统互斥体对象。
  * @param handle - 互斥体对象句柄。
@@ -111,6 +323,15 @@ extern void   mutexDelete( HANDLE handle );
  */
 extern STATUS mutexLock( HANDLE handle, int tminms );
 
+/**
+ * @brief 在截止时间之前等待操作系统互斥体对象。
+ * @param handle - 互斥体对象句柄。
+ * @param deadline - 由OSA_deadline得到的截止时间，DEADLINE_NO_WAIT - 不等待，
+ *                   DEADLINE_FOREVER - 无限等待。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS mutexLockUntil( HANDLE handle, UINT64 deadline );
+
 /**
  * @brief 释放操作系统互斥体对象。
  * @param handle - 互斥体对象句柄。
@@ -118,8 +339,149 @@ extern STATUS mutexLock( HANDLE handle, int tminms );
  */
 extern STATUS mutexUnlock( HANDLE handle );
 
+/**
+ * @brief 检测互斥体的上一个持有者是否在持有时退出，由当前持有者在加锁成功后调用。
+ *        MUTEX_OPT_ROBUST互斥体在这种情况下仍加锁成功，持有者应修复被保护的数据。
+ * @param handle - 互斥体对象句柄。
+ * @return	TRUE - 上一个持有者已退出，FALSE - 否。
+ */
+extern BOOL   mutexOwnerDied( HANDLE handle );
+
+/**
+ * @brief 获取自适应互斥体对象的自旋统计信息。
+ * @param handle - 互斥体对象句柄。
+ * @param stats - 统计信息的返回地址。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS mutexGetSpinStats( HANDLE handle, OSA_SPIN_STATS *stats );
+
+/* Reader-writer lock interface */
+
+/**
+ * @brief 创建操作系统读写锁对象。
+ *        读任务在各自缓存行的计数槽中计数，不同核上的读任务互不干扰；
+ *        写任务优先，有写任务持有或等待时，新的读任务等待。
+ *        读锁不可递归，读锁和写锁必须由加锁任务释放。
+ * @return	读写锁对象句柄，NULL - 失败。
+ */
+extern HANDLE rwlockCreate( void );
+
+/**
+ * @brief 删除操作系统读写锁对象。
+ * @param handle - 读写锁对象句柄。
+ * @return	无。
+ */
+extern void   rwlockDelete( HANDLE handle );
+
+/**
+ * @brief 以读方式锁定读写锁对象。
+ * @param handle - 读写锁对象句柄。
+ * @param tminms - 等待时间，单位毫秒，0 - 不等待，-1 - 无限等待，>0 - 计时等待。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS rwlockReadLock( HANDLE handle, int tminms );
+
+/**
+ * @brief 在截止时间之前以读方式锁定读写锁对象。
+ * @param handle - 读写锁对象句柄。
+ * @param deadline - 由OSA_deadline得到的截止时间，DEADLINE_NO_WAIT - 不等待，
+ *                   DEADLINE_FOREVER - 无限等待。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS rwlockReadLockUntil( HANDLE handle, UINT64 deadline );
+
+/**
+ * @brief 释放读写锁对象的读锁。
+ * @param handle - 读写锁对象句柄。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS rwlockReadUnlock( HANDLE handle );
+
+/**
+ * @brief 以写方式锁定读写锁对象。
+ * @param handle - 读写锁对象句柄。
+ * @param tminms - 等待时间，单位毫秒，0 - 不等待，-1 - 无限等待，>0 - 计时等待。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS rwlockWriteLock( HANDLE handle, int tminms );
+
+/**
+ * @brief 在截止时间之前以写方式锁定读写锁对象。
+ * @param handle - 读写锁对象句柄。
+ * @param deadline - 由OSA_deadline得到的截止时间，DEADLINE_NO_WAIT - 不等待，
+ *                   DEADLINE_FOREVER - 无限等待。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS rwlockWriteLockUntil( HANDLE handle, UINT64 deadline );
+
+/**
+ * @brief 释放读写锁对象的写锁。
+ * @param handle - 读写锁对象句柄。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS rwlockWriteUnlock( HANDLE handle );
+
+/* RCU interface */
+
+/**
+ * @brief 在读临界区中读取受RCU保护的指针。
+ */
+#define RCU_DEREF(p)      __atomic_load_n(&(p), __ATOMIC_CONSUME)
+
+/**
+ * @brief 发布受RCU保护的指针，新对象的内容在指针之前对读任务可见。
+ */
+#define RCU_ASSIGN(p, v)  __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+/**
+ * @brief 进入RCU读临界区，可以嵌套。
+ *        读临界区不加锁，不执行原子操作，只写当前任务自己的缓存行；
+ *        任务首次进入时自动注册，退出时自动注销。
+ *        读临界区中不能调用rcuSynchronize和rcuBarrier。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS rcuReadLock( void );
+
+/**
+ * @brief 退出RCU读临界区。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS rcuReadUnlock( void );
+
+/**
+ * @brief 等待一个宽限期，返回后已经没有读任务持有此前摘除的对象。
+ * @return	无。
+ */
+extern void   rcuSynchronize( void );
+
+/**
+ * @brief 在一个宽限期之后调用回调函数，调用任务不会阻塞。
+ *        回调函数成批共享一个宽限期，由之后的rcuCall、rcuSynchronize、rcuBarrier
+ *        或定时器任务调用，不再调用RCU接口时最迟在几十毫秒内调用。
+ * @param func - 回调函数，一般用于释放摘除的对象。
+ * @param arg - 回调函数的参数。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS rcuCall( void (*func)(void*), void *arg );
+
+/**
+ * @brief 在一个宽限期之后用MEMDEL释放存储空间，
+ *        用于释放从无锁容器或SL_LIST表中摘除的节点。
+ * @param ptr - 由MEMNEW分配的存储空间。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS rcuFree( void *ptr );
+
+/**
+ * @brief 等待此前提交的所有回调函数调用完成。
+ * @return	无。
+ */
+extern void   rcuBarrier( void );
+
 /* Semaphore interface */
 
+#define SEM_OPT_ADAPTIVE 0x01 /**< 自适应等待，先自旋再睡眠 */
+
 /**
  * @brief 创建操作系统信号量对象。
  * @param count - 信号量计数。
@@ -127,6 +489,16 @@ extern STATUS mutexUnlock( HANDLE handle );
  */
 extern HANDLE semCreate( int count );
 
+/**
+ * @brief 按指定的选项创建操作系统信号量对象。
+ *        SEM_OPT_ADAPTIVE选项使等待任务先自旋检查计数，在自旋次数内未等到时再睡眠。
+ * @param count - 信号量计数。
+ * @param options - 选项，0或SEM_OPT_ADAPTIVE。
+ * @param spin - 自旋次数，0 - 使用OSA_SPIN_DEFAULT。
+ * @return	信号量对象句柄，NULL - 失败。
+ */
+extern HANDLE semCreateEx( int count, int options, int spin );
+
 /**
  * @brief 删除操作系统信号量对象。
  * @param handle - 信号量对象句柄。
@@ -143,6 +515,15 @@ extern void   semDelete( HANDLE handle );
  */
 extern STATUS semWait( HANDLE handle, int tminms );
 
+/**
+ * @brief 在截止时间之前等待操作系统信号量对象。
+ * @param handle - 信号量对象句柄。
+ * @param deadline - 由OSA_deadline得到的截止时间，DEADLINE_NO_WAIT - 不等待，
+ *                   DEADLINE_FOREVER - 无限等待。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS semWaitUntil( HANDLE handle, UINT64 deadline );
+
 /**
  * @brief  发送操作系统信号量对象，将信号量的计数加1，如果有其他的线程中等待该信号
            量，则唤醒等待线程。
@@ -151,6 +532,23 @@ extern STATUS semWait( HANDLE handle, int tminms );
  */
 extern STATUS semPost( HANDLE handle );
 
+/**
+ * @brief  等待操作系统信号量对象的n个计数，计数足够时一次全部获得。
+ * @param  handle - 信号量对象句柄。
+ * @param  n - 计数的数量。
+ * @param  tminms - 等待时间，单位毫秒，0 - 不等待，-1 - 无限等待，>0 - 计时等待。
+ * @return 0 -成功，-1-失败。
+ */
+extern STATUS semWaitN( HANDLE handle, int n, int tminms );
+
+/**
+ * @brief  一次发送操作系统信号量对象的n个计数，最多唤醒一次等待线程。
+ * @param  handle - 信号量对象句柄。
+ * @param  n - 计数的数量。
+ * @return 0 -成功，-1-失败。
+ */
+extern STATUS semPostN( HANDLE handle, int n );
+
 /**
  * @brief  获取操作系统信号量对象的计数。
  * @param  handle - 信号量对象句柄。
@@ -158,10 +556,62 @@ extern STATUS semPost( HANDLE handle );
  */
 extern int    semCount( HANDLE handle );
 
+/**
+ * @brief  获取自适应信号量对象的自旋统计信息。
+ * @param  handle - 信号量对象句柄。
+ * @param  stats - 统计信息的返回地址。
+ * @return 0 -成功，-1-失败。
+ */
+extern STATUS semGetSpinStats( HANDLE handle, OSA_SPIN_STATS *stats );
+
 /* Message queue interface */
 
 #define MSG_PRI_NORMAL	0	/**< 普通优先级 */
 #define MSG_PRI_URGENT	1	/**< 紧急优先级 */
+#define MSG_PRI_MAX		31	/**< 最高优先级 */
+
+#define MQ_TYPE_DEFAULT	0	/**< 基于互斥体的通用消息队列 */
+#define MQ_TYPE_SPSC	1	/**< 单生产者/单消费者无锁消息队列 */
+#define MQ_TYPE_MPMC	2	/**< 多生产者/多消费者无锁消息队列 */
+#define MQ_TYPE_SHARED	3	/**< 进程间共享的消息队列，由mqOpenShared打开 */
+
+#define MQ_SIZE_CLASSES	8	/**< 变长消息队列支持的最大消息长度级别数量 */
+
+/**
+ * @brief 变长消息队列的消息长度级别。
+ */
+typedef struct MQ_SIZE_CLASS
+{
+	int   maxMsgs; /**< 该级别支持的最大消息数量 */
+	int maxMsgLen; /**< 该级别支持的最大消息长度 */
+}
+MQ_SIZE_CLASS;
+
+/**
+ * @brief 消息队列的统计信息。
+ */
+typedef struct MQ_STATS
+{
+	UINT64             sent; /**< 发送的消息总数 */
+	UINT64         received; /**< 接收的消息总数 */
+	int               depth; /**< 当前队列中的消息数量 */
+	int           highWater; /**< 队列中消息数量的最大值 */
+	UINT64     blockedSends; /**< 发送时等待的次数 */
+	UINT64  blockedReceives; /**< 接收时等待的次数 */
+	UINT64    sendBlockedNs; /**< 发送时等待的累计时间，单位纳秒 */
+	UINT64 receiveBlockedNs; /**< 接收时等待的累计时间，单位纳秒 */
+}
+MQ_STATS;
+
+/**
+ * @brief 批量发送和接收消息的描述。
+ */
+typedef struct MQ_VEC
+{
+	char *buffer; /**< 消息缓冲区 */
+	int   nbytes; /**< 消息的字节大小，接收时为缓冲区大小，返回时为接收的字节数量 */
+}
+MQ_VEC;
 
 /**
  * @brief  创建消息队列。
@@ -172,23 +622,84 @@ extern int    semCount( HANDLE handle );
 extern HANDLE mqCreate( int max_msgs, int max_msg_len );
 
 /**
- * @brief  删除消息队列。
+ * @brief  按指定的类型创建消息队列。
+ *         - MQ_TYPE_SPSC类型的消息队列只允许一个发送任务和一个接收任务同时访问。
+ *         - MQ_TYPE_MPMC类型的消息队列允许多个发送任务和多个接收任务同时访问，
+ *           通过每个消息槽的序号交接消息，不使用全局互斥体。
+ *         - 无锁消息队列只有在队列为空或满时才进入等待，消息数量向上取整为2的幂，
+ *           不支持消息优先级，所有消息按发送顺序接收。
+ * @param  max_msgs - 支持的最大消息数量。
+ * @param  max_msg_len - 支持的最大消息长度。
+ * @param  type - 消息队列类型，MQ_TYPE_DEFAULT，MQ_TYPE_SPSC或MQ_TYPE_MPMC。
+ * @return 消息队列句柄，NULL-失败。
+ */
+extern HANDLE mqCreateEx( int max_msgs, int max_msg_len, int type );
+
+/**
+ * @brief  创建变长消息队列，消息按长度从多个预分配的消息池中选取最小的可容纳
+ *         级别，该级别已满时使用更大的级别，从而内存占用与实际消息长度分布一致，
+ *         发送和接收时不分配内存。
+ * @param  classes - 消息长度级别数组。
+ * @param  nclasses - 消息长度级别的数量，最大为MQ_SIZE_CLASSES。
+ * @return 消息队列句柄，NULL-失败。
+ */
+extern HANDLE mqCreateVar( const MQ_SIZE_CLASS *classes, int nclasses );
+
+/**
+ * @brief  删除消息队列。MQ_TYPE_SHARED类型的消息队列只解除本进程的映射，
+ *         共享内存对象由mqUnlinkShared删除。
  * @param  handle - 消息队列句柄。
  * @return 无。
  */
 extern void   mqDelete( HANDLE handle );
 
+/**
+ * @brief  打开命名的进程间共享消息队列，不存在时创建。
+ *         - 消息队列位于POSIX共享内存中，链表使用偏移量而不是指针，
+ *           因此各进程可以映射到不同的地址，消息跨进程只拷贝一次。
+ *         - 使用进程间共享的健壮互斥体，持有锁的进程异常退出后，
+ *           下一个加锁的进程重置消息队列，队列中的消息被丢弃。
+ *         - 支持消息优先级和批量收发，不支持mqSendLoan和mqReceiveLoan。
+ * @param  name - 共享内存对象的名称，以'/'开头。
+ * @param  max_msgs - 支持的最大消息数量，只在创建时使用。
+ * @param  max_msg_len - 支持的最大消息长度，打开已存在的消息队列时，
+ *                       其最大消息长度不能小于该值。
+ * @return 消息队列句柄，NULL-失败。
+ */
+extern HANDLE mqOpenShared( const char *name, int max_msgs, int max_msg_len );
+
+/**
+ * @brief  删除命名的进程间共享消息队列，已打开的进程可以继续使用，
+ *         所有进程调用mqDelete后释放共享内存。
+ * @param  name - 共享内存对象的名称。
+ * @return 0 -成功，-1-失败。
+ */
+extern STATUS mqUnlinkShared( const char *name );
+
 /**
  * @brief  向消息队列发送指定的消息。
  * @param  handle - 消息队列句柄。
  * @param  buffer - 消息缓冲区。
  * @param  nbytes - 消息的字节大小。
  * @param  tminms - 等待时间，单位毫秒，0 - 不等待，-1 - 无限等待，>0 - 计时等待。
- * @param  priority - 消息发送的紧急程度，MSG_PRI_NORMAL或MSG_PRI_URGENT。
+ * @param  priority - 消息的优先级，MSG_PRI_NORMAL到MSG_PRI_MAX，优先级高的消息先被接收，
+ *                    同一优先级的消息按发送顺序接收。
  * @return 成功发送的字节数量，-1-失败。
  */
 extern int    mqSend( HANDLE handle, char *buffer, int nbytes, int tminms, int priority );
 
+/**
+ * @brief  在截止时间之前向消息队列发送指定的消息。
+ * @param  handle - 消息队列句柄。
+ * @param  buffer - 消息缓冲区。
+ * @param  nbytes - 消息的字节大小。
+ * @param  deadline - 由OSA_deadline得到的截止时间，DEADLINE_NO_WAIT - 不等待，
+ *                    DEADLINE_FOREVER - 无限等待。
+ * @param  priority - 消息的优先级，MSG_PRI_NORMAL到MSG_PRI_MAX。
+ * @return 成功发送的字节数量，-1-失败。
+ */
+extern int    mqSendUntil( HANDLE handle, char *buffer, int nbytes, UINT64 deadline, int priority );
+
 /**
  * @brief  从消息队列接收消息。
  * @param  handle - 消息队列句柄。
@@ -200,24 +711,134 @@ extern int    mqSend( HANDLE handle, char *buffer, int nbytes, int tminms, int p
 extern int    mqReceive( HANDLE handle, char *buffer, int maxnbytes, int tminms );
 
 /**
- * @brief  查询指定消息队列的消息数量。
+ * @brief  在截止时间之前从消息队列接收消息。
+ * @param  handle - 消息队列句柄。
+ * @param  buffer - 消息缓冲区。
+ * @param  maxnbytes - 消息的最大字节大小。
+ * @param  deadline - 由OSA_deadline得到的截止时间，DEADLINE_NO_WAIT - 不等待，
+ *                    DEADLINE_FOREVER - 无限等待。
+ * @return 成功接收的字节数量，-1-失败。
+ */
+extern int    mqReceiveUntil( HANDLE handle, char *buffer, int maxnbytes, UINT64 deadline );
+
+/**
+ * @brief  向消息队列批量发送消息，只在发送第一个消息时等待，其余消息在队列
+ *         未满时一次加锁发送完成，最多唤醒一次接收任务。
+ * @param  handle - 消息队列句柄。
+ * @param  vec - 消息描述数组。
+ * @param  count - 消息的数量。
+ * @param  tminms - 等待时间，单位毫秒，0 - 不等待，-1 - 无限等待，>0 - 计时等待。
+ * @param  priority - 消息的优先级，MSG_PRI_NORMAL到MSG_PRI_MAX，优先级高的消息先被接收，
+ *                    同一优先级的消息按发送顺序接收。
+ * @return 成功发送的消息数量，-1-失败。
+ */
+extern int    mqSendBatch( HANDLE handle, MQ_VEC *vec, int count, int tminms, int priority );
+
+/**
+ * @brief  从消息队列批量接收消息，只在接收第一个消息时等待，其余消息在队列
+ *         非空时一次加锁接收完成，最多唤醒一次发送任务。
+ * @param  handle - 消息队列句柄。
+ * @param  vec - 消息描述数组，nbytes为缓冲区大小，返回时为接收的字节数量。
+ * @param  count - 消息的最大数量。
+ * @param  tminms - 等待时间，单位毫秒，0 - 不等待，-1 - 无限等待，>0 - 计时等待。
+ * @return 成功接收的消息数量，-1-失败。
+ */
+extern int    mqReceiveBatch( HANDLE handle, MQ_VEC *vec, int count, int tminms );
+
+/**
+ * @brief  从消息队列借用一个空闲的消息缓冲区，消息直接在该缓冲区中构造，
+ *         然后通过mqSendCommit发送，避免消息的拷贝。
+ *         MQ_TYPE_SPSC类型的消息队列同时只能借用一个缓冲区，借用期间不能调用mqSend。
+ * @param  handle - 消息队列句柄。
+ * @param  nbytes - 消息的最大字节大小。
+ * @param  tminms - 等待时间，单位毫秒，0 - 不等待，-1 - 无限等待，>0 - 计时等待。
+ * @return 消息缓冲区指针，NULL-失败。
+ */
+extern char*  mqSendLoan( HANDLE handle, int nbytes, int tminms );
+
+/**
+ * @brief  发送由mqSendLoan借用的消息缓冲区，缓冲区归还给消息队列。
+ * @param  handle - 消息队列句柄。
+ * @param  buffer - mqSendLoan返回的消息缓冲区。
+ * @param  nbytes - 消息的字节大小。
+ * @param  priority - 消息的优先级，MSG_PRI_NORMAL到MSG_PRI_MAX，优先级高的消息先被接收，
+ *                    同一优先级的消息按发送顺序接收。
+ * @return 0 -成功，-1-失败。
+ */
+extern STATUS mqSendCommit( HANDLE handle, char *buffer, int nbytes, int priority );
+
+/**
+ * @brief  从消息队列接收消息，但不拷贝消息，直接返回消息所在的缓冲区，
+ *         读取完成后通过mqReceiveRelease归还。
+ *         MQ_TYPE_SPSC类型的消息队列同时只能借用一个缓冲区，借用期间不能调用mqReceive。
+ * @param  handle - 消息队列句柄。
+ * @param  pbuffer - 消息缓冲区指针的返回地址。
+ * @param  tminms - 等待时间，单位毫秒，0 - 不等待，-1 - 无限等待，>0 - 计时等待。
+ * @return 消息的字节数量，-1-失败。
+ */
+extern int    mqReceiveLoan( HANDLE handle, char **pbuffer, int tminms );
+
+/**
+ * @brief  将mqReceiveLoan返回的消息缓冲区归还给消息队列。
+ * @param  handle - 消息队列句柄。
+ * @param  buffer - mqReceiveLoan返回的消息缓冲区。
+ * @return 0 -成功，-1-失败。
+ */
+extern STATUS mqReceiveRelease( HANDLE handle, char *buffer );
+
+/**
+ * @brief  查询指定消息队列的消息数量，不对消息队列加锁。
  * @param  handle - 消息队列句柄。
  * @return 消息队列中消息数量。
  */
 extern int    mqCount( HANDLE handle );
 
+/**
+ * @brief  获取消息队列的统计信息，不对消息队列加锁，因此不影响消息的收发，
+ *         但在队列繁忙时各项统计不保证严格一致。无锁消息队列的最大值为采样值。
+ * @param  handle - 消息队列句柄。
+ * @param  stats - 统计信息的返回地址。
+ * @return 0 -成功，-1-失败。
+ */
+extern STATUS mqGetStats( HANDLE handle, MQ_STATS *stats );
+
+/**
+ * @brief  获取消息队列的通知文件描述符，队列中有消息时该描述符可读，
+ *         因此任务可以通过select或poll同时等待消息队列、套接字和串口，
+ *         可读后以NO_WAIT方式接收消息。
+ *         - 描述符在第一次调用时创建，由mqDelete关闭，调用者不能读取或关闭该描述符。
+ *         - 不调用该函数的消息队列在收发时没有额外开销。
+ *         - MQ_TYPE_SHARED类型的消息队列不支持。
+ * @param  handle - 消息队列句柄。
+ * @return 文件描述符，-1-失败。
+ */
+extern int    mqGetFd( HANDLE handle );
+
 /* Task interface */
 
 /**
  * @brief  按指定的属性创建任务。
  * @param  prio - 任务的优先级，有效范围和系统的实现有关，在ITC中为0-99。
- * @param  stksz - 任务栈的大小，为0则使用操作系统的默认值。
+ * @param  stksz - 任务栈的大小，为0则使用默认值256KB。任务栈从栈池分配，
+ *                 带保护页并预先访问，运行时不会产生缺页。
  * @param  entry - 任务的回调函数。
  * @param  arg - 任务的回调函数参数。
  * @return 操作系统任务的句柄。
  */
 extern HANDLE tskCreate( int prio, int stksz, int(*entry)(void*), void *arg );
 
+/**
+ * @brief  按指定的属性创建绑定到指定CPU集合的任务，任务从开始运行起就不会迁移到集合外的CPU。
+ * @param  prio - 任务的优先级，有效范围和系统的实现有关，在ITC中为0-99。
+ * @param  stksz - 任务栈的大小，为0则使用默认值256KB。任务栈从栈池分配，
+ *                 带保护页并预先访问，运行时不会产生缺页。
+ * @param  entry - 任务的回调函数。
+ * @param  arg - 任务的回调函数参数。
+ * @param  cpus - CPU集合，第n位对应第n个CPU，0 - 不限制。
+ * @return 操作系统任务的句柄。
+ */
+extern HANDLE tskCreateEx( int prio, int stksz, int(*entry)(void*), void *arg, UINT64 cpus );
+
 /**
  * @brief  删除指定的任务，退出任务并释放任务所占用的资源。
  * @param  handle - 任务的句柄。
@@ -228,7 +849,8 @@ extern STATUS tskDelete( HANDLE handle );
 /**
  * @brief  按指定的属性创建任务并立即投入运行。
  * @param  prio - 任务的优先级，有效范围和系统的实现有关，在ITC中为0-99。
- * @param  stksz - 任务栈的大小，为0则使用操作系统的默认值。
+ * @param  stksz - 任务栈的大小，为0则使用默认值256KB。任务栈从栈池分配，
+ *                 带保护页并预先访问，运行时不会产生缺页。
  * @param  entry - 任务的回调函数。
  * @param  arg - 任务的回调函数参数。
  * @return 操作系统任务的句柄。
@@ -265,6 +887,96 @@ extern STATUS tskSetPriority( HANDLE handle, int prio );
  */
 extern STATUS tskGetPriority( HANDLE handle, int *prio );
 
+/**
+ * @brief  将任务绑定到指定的CPU集合。任务未运行时失败，启动前的绑定由tskCreateEx指定。
+ * @param  handle - 任务的句柄，NULL - 当前任务。
+ * @param  cpus - CPU集合，第n位对应第n个CPU。
+ * @return 0 -成功，-1-失败。
+ */
+extern STATUS tskSetAffinity( HANDLE handle, UINT64 cpus );
+
+/**
+ * @brief  获取任务绑定的CPU集合，任务未运行时失败。
+ * @param  handle - 任务的句柄，NULL - 当前任务。
+ * @param  cpus - CPU集合返回地址。
+ * @return 0 -成功，-1-失败。
+ */
+extern STATUS tskGetAffinity( HANDLE handle, UINT64 *cpus );
+
+/**
+ * @brief 周期任务的释放统计信息，时间单位为纳秒。
+ */
+typedef struct TSK_PERIOD_STATS
+{
+	UINT64    period; /**< 周期 */
+	UINT64  releases; /**< 释放的次数 */
+	UINT64  overruns; /**< 超时错过的释放次数 */
+	UINT64 jitterMin; /**< 最小释放抖动，唤醒时刻晚于释放时刻的时间 */
+	UINT64 jitterMax; /**< 最大释放抖动 */
+	UINT64 jitterSum; /**< 释放抖动的累计值，除以释放次数得到平均值 */
+}
+TSK_PERIOD_STATS;
+
+/**
+ * @brief  将当前任务设置为周期任务，首次释放在一个周期之后，统计信息清零。
+ *         释放时刻是基于CLOCK_MONOTONIC的绝对时间，任务的执行时间不会累积为漂移。
+ * @param  periodns - 周期，单位纳秒，0 - 取消周期。
+ * @return 0 -成功，-1-失败。
+ */
+extern STATUS tskSetPeriod( UINT64 periodns );
+
+/**
+ * @brief  等待当前任务的下一次释放。任务超时错过的释放计为超限并跳过，保持相位不变。
+ * @return 本次错过的释放次数，0 - 未超时，-1 - 当前任务不是周期任务。
+ */
+extern int    tskWaitPeriod( void );
+
+/**
+ * @brief  获取当前任务的周期释放统计信息。
+ * @param  stats - 统计信息的返回地址。
+ * @return 0 -成功，-1-失败。
+ */
+extern STATUS tskGetPeriodStats( TSK_PERIOD_STATS *stats );
+
+/* 唤醒延迟直方图的桶数 */
+#define TSK_LATENCY_BUCKETS 16
+
+/**
+ * @brief 任务的运行统计信息，时间单位为纳秒。
+ *        唤醒延迟是定时唤醒（延时、周期释放、等待超时）晚于预定时刻的时间。
+ */
+typedef struct TSK_STATS
+{
+	int               id; /**< 内核线程ID，0 - 任务未运行 */
+	int             prio; /**< 任务的优先级 */
+	UINT64       cpuTime; /**< 占用的CPU时间 */
+	UINT64   volSwitches; /**< 主动让出CPU的上下文切换次数 */
+	UINT64 involSwitches; /**< 被抢占的上下文切换次数 */
+	UINT64      runDelay; /**< 就绪后等待CPU的累计时间，内核不支持时为0 */
+	UINT64   blockedTime; /**< 阻塞在OSA同步原语中的累计时间 */
+	UINT64        blocks; /**< 阻塞在OSA同步原语中的次数 */
+	UINT64       wakeups; /**< 定时唤醒的次数 */
+	UINT64    latencyMax; /**< 最大唤醒延迟 */
+	UINT64 latency[TSK_LATENCY_BUCKETS]; /**< 唤醒延迟直方图，第0个桶小于1微秒，
+	                                          第n个桶为[2^(n-1), 2^n)微秒，最后一个桶包含更大的延迟 */
+	UINT32     stackSize; /**< 任务栈的大小，单位字节，0 - 非tskCreate创建的任务 */
+	UINT32     stackUsed; /**< 任务栈使用的最大深度，单位字节 */
+}
+TSK_STATS;
+
+/**
+ * @brief  获取任务的运行统计信息。
+ * @param  handle - 任务的句柄，NULL - 当前任务。
+ * @param  stats - 输出的统计信息。
+ * @return 0 -成功，-1-失败。
+ */
+extern STATUS tskGetStats( HANDLE handle, TSK_STATS *stats );
+
+/**
+ * @brief  在标准输出打印所有任务的运行统计信息。
+ */
+extern void   tskShowAll( void );
+
 /**
  * @brief  检测任务是否为当前任务。
  * @param  handle - 任务的句柄。
@@ -279,6 +991,74 @@ extern BOOL   tskSelf( HANDLE handle );
  */
 extern int    tskGetId( HANDLE handle );
 
+/* Timer interface */
+
+/**
+ * @brief 创建定时器，定时器由一个定时器任务驱动，不为每个定时器创建任务。
+ *        定时器的启动和取消的开销与定时器的数量无关，精度为1毫秒。
+ * @param func - 定时器到期时在定时器任务中调用的函数，应尽快返回。
+ * @param arg - 到期函数的参数。
+ * @return	定时器句柄，NULL - 失败。
+ */
+extern HANDLE timerCreate( void (*func)(void*), void *arg );
+
+/**
+ * @brief 取消并删除定时器，等待正在执行的到期函数返回；
+ *        在自己的到期函数中删除时，定时器在到期函数返回后释放。
+ * @param handle - 定时器句柄。
+ * @return	无。
+ */
+extern void   timerDelete( HANDLE handle );
+
+/**
+ * @brief 启动定时器，已启动的定时器重新计时。
+ * @param handle - 定时器句柄。
+ * @param delayms - 首次到期的延时，单位毫秒。
+ * @param periodms - 到期的周期，单位毫秒，0 - 单次定时器。
+ * @return	0 -成功，-1-失败。
+ */
+extern STATUS timerStart( HANDLE handle, int delayms, int periodms );
+
+/**
+ * @brief 取消定时器，等待正在执行的到期函数返回，在自己的到期函数中取消时不等待。
+ * @param handle - 定时器句柄。
+ * @return	0 -成功，-1-定时器未启动。
+ */
+extern STATUS timerCancel( HANDLE handle );
+
+/* Thread pool interface */
+
+/**
+ * @brief 创建线程池，工作任务只创建一次，之后提交的工作项由它们执行。
+ *        每个工作任务有自己的工作窃取队列，空闲的工作任务从其他任务的队列中窃取工作项，
+ *        工作项的分发不经过所有任务共享的锁。
+ * @param workers - 工作任务的数量。
+ * @param prio - 工作任务的缺省优先级，范围同tskCreate。
+ * @param depth - 每个队列每个优先级的工作项容量，向上取整为2的幂。
+ * @param cpus - 工作任务运行的CPU集合，第n位对应第n个CPU，0 - 不限制。
+ * @return	线程池句柄，NULL - 失败。
+ */
+extern HANDLE tpoolCreate( int workers, int prio, int depth, UINT64 cpus );
+
+/**
+ * @brief 删除线程池，已提交的工作项执行完成后工作任务退出。不能由工作任务调用。
+ * @param handle - 线程池句柄。
+ * @return	无。
+ */
+extern void   tpoolDelete( HANDLE handle );
+
+/**
+ * @brief 向线程池提交工作项，调用任务不会阻塞。
+ *        工作任务提交的工作项进入自己的队列，队列满时由自己直接执行。
+ * @param handle - 线程池句柄。
+ * @param func - 工作项的回调函数。
+ * @param arg - 回调函数的参数。
+ * @param prio - 执行工作项的任务优先级，范围同tskCreate，高优先级的工作项优先执行，
+ *               0 - 线程池的缺省优先级。
+ * @return	0 -成功，-1-失败(队列满)。
+ */
+extern STATUS tpoolSubmit( HANDLE handle, void (*func)(void*), void *arg, int prio );
+
 #endif /* _OSA_H_ */
 
 /*
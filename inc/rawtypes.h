@@ -93,6 +93,8 @@ typedef int               INT32; /**< 32位整型数据 */
 typedef unsigned int     UINT32; /**< 无符号32位整型数据 */
 typedef long               LONG; /**< 长整型数据 */
 typedef unsigned long      ULNG; /**< 无符号长整型数据 */
+typedef long long         INT64; /**< 64位整型数据 */
+typedef unsigned long long UINT64; /**< 无符号64位整型数据 */
 typedef void*             PVOID; /**< 通用指针 */
 typedef PVOID            HANDLE; /**< 对象句柄 */
 typedef char*             PCHAR; /**< 字符串指针 */
@@ -6,11 +6,28 @@ modification history
 1.00, 2011-2-15, youyq initial 
 */
 
+/* pthread_mutex_clocklock() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
 #include <sys/time.h>
+#include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
+#include <linux/membarrier.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
 #include <bufops.h>
 #include <osa.h>
 #include "usrlinuxos.h"
@@ -56,6 +73,9 @@ OSA_init( int(*init)(void*), void* arg, void(*cleanup)(void) )
 	    goto init_failed;
 	}
 
+	/* calibrate the fast clock before tasks take timestamps */
+	(void)OSA_fastNs();
+
     /* Call init routine if have. */
 	if(init != NULL) 
 	{
@@ -116,719 +136,4159 @@ OSA_attachSigHandler( int sigid, void(*handler)(int) )
 }
 
 /*
-// OSA_evalAbsTime - convert time value to absolute ABSTMS
+// OSA_deadline - convert a timeout to an absolute deadline
 //
-// RETURNS: N/A.
+// Deadlines are taken once on CLOCK_MONOTONIC, so that spurious wakeups
+// never stretch a timed wait, and clock steps or NTP slews never change it.
+//
+// RETURNS: nanoseconds of CLOCK_MONOTONIC, DEADLINE_NO_WAIT or DEADLINE_FOREVER.
 */
-void 
-OSA_evalAbsTime( struct timespec *abstms, UINT32 tminms )
+UINT64 
+OSA_deadline( int tminms )
 {
-	clock_gettime( CLOCK_REALTIME, abstms ); 
-	if( tminms ) 
-	{
-		abstms->tv_sec  += (tminms / 1000);
-		abstms->tv_nsec += (tminms % 1000 * 1000000);
-	}
+	if (tminms == WAIT_FOREVER) return DEADLINE_FOREVER;
+	if (tminms <= NO_WAIT) return DEADLINE_NO_WAIT;
+
+	return OSA_nowNs() + (UINT64)tminms * 1000000ULL;
 }
 
 /*
-// OSA_delay - Delay time in microseconds.
+// OSA_deadlineTime - convert an absolute deadline to timespec ABSTMS
 //
 // RETURNS: N/A.
 */
 void 
-OSA_delay( UINT32 msecs )
+OSA_deadlineTime( struct timespec *abstms, UINT64 deadline )
 {
-	struct timespec delayTime, elaspedTime;
-  
-	delayTime.tv_sec  = msecs / 1000;
-	delayTime.tv_nsec = ( msecs % 1000 ) * 1000000;
-
-	nanosleep(&delayTime, &elaspedTime);
+	abstms->tv_sec  = (time_t)(deadline / 1000000000ULL);
+	abstms->tv_nsec = (long)(deadline % 1000000000ULL);
 }
 
-/********************************************************************************
-// L I N U X  E V E N T  R O U T I N E S
-********************************************************************************/
 /*
-// eventCreate - create and initialize a osa flag
-//
-// This routine creates a osa flag. 
+// OSA_condInit - initialize a condition variable timed on CLOCK_MONOTONIC
 //
-// RETURNS: Handle to OS flag, or NULL if error.
+// RETURNS: 0 if success, or error number.
 */
-HANDLE
-eventCreate( void )
+int 
+OSA_condInit( pthread_cond_t *pCond, int pshared )
 {
-	OSEvent* pEvent = (OSEvent*)MEMNEW(sizeof(OSEvent));
-	int status = OK;
-	
-    if (pEvent == NULL) return (NULL);
-    
-    status = pthread_mutex_init( &pEvent->lock, NULL );
-	status |= pthread_cond_init( &pEvent->cond, NULL );
-	if (status) 
-	{
-		MEMDEL( pEvent );
-		return (NULL);
-	}
+	pthread_condattr_t attr;
+	int status = 0;
 
-	pEvent->flag = 0;
+	status |= pthread_condattr_init(&attr);
+	status |= pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	status |= pthread_condattr_setpshared(&attr, pshared);
+	status |= pthread_cond_init(pCond, &attr);
+	pthread_condattr_destroy(&attr);
 
-    return (HANDLE)pEvent;
+	return status;
 }
 
 /*
-// eventDelete - delete a osa flag.
+// OSA_condWaitUntil - pend on a condition variable until a deadline
 //
-// This routine deletes a osa flag.
+// The condition must be initialized by OSA_condInit(), the caller holds
+// <pLock> and checks its predicate again after every return.
 //
-// RETURNS: N/A.
+// RETURNS: 0 if woken up, ETIMEDOUT if the deadline expired, or error number.
 */
-void
-eventDelete( HANDLE handle )
+int 
+OSA_condWaitUntil( pthread_cond_t *pCond, pthread_mutex_t *pLock, UINT64 deadline )
 {
-	OSEvent* pEvent = (OSEvent*)handle;
-	
-	if (pEvent==NULL) return;
-	
-	pEvent->flag   = 0;
-	pthread_cond_destroy(&pEvent->cond);
-	pthread_mutex_destroy(&pEvent->lock);
+	struct timespec abstm;
+	UINT64 since;
+	int status;
 
-	MEMDEL((char*)pEvent);
+	if ((deadline != DEADLINE_FOREVER) && (deadline <= OSA_nowNs()))
+		return ETIMEDOUT;
+
+	since = OSA_fastNs();
+	if (deadline == DEADLINE_FOREVER)
+		status = pthread_cond_wait(pCond, pLock);
+	else
+	{
+		OSA_deadlineTime(&abstm, deadline);
+		status = pthread_cond_timedwait(pCond, pLock, &abstm);
+		if (status == ETIMEDOUT) OSA_statWakeup( deadline );
+	}
+	OSA_statBlocked( since );
+
+	return status;
 }
 
-/* 
-// eventWait - wait a osa flag(s) with mode and timeout.
+/*
+// OSA_futexWait - pend on a futex word of this process
 //
-// RETURNS: OK if success, otherwize ERROR.
+// Sleeps while *<addr> equals <val>, until woken up or the CLOCK_MONOTONIC
+// <deadline> expires.
+//
+// RETURNS: 0 if woken up, or -1 with errno set (ETIMEDOUT, EAGAIN, EINTR).
 */
-STATUS 
-eventWait( HANDLE handle, int tminms )
+int 
+OSA_futexWait( volatile INT32 *addr, INT32 val, UINT64 deadline )
 {
-	OSEvent* pEvent = (OSEvent*)handle;
-	int status = OK;
-
-	if (pEvent == NULL) return ERROR;
+	struct timespec abstm, *pabstm = NULL;
+	UINT64 since = OSA_fastNs();
+	int status, error;
 
-	pthread_mutex_lock(&pEvent->lock);
-	
-	if(!pEvent->flag)
+	if (deadline != DEADLINE_FOREVER)
 	{
-		if(tminms == NO_WAIT)
-		{
-			status = ERROR;
-		}
-		else if (tminms == WAIT_FOREVER) 
-		{
-			status = pthread_cond_wait(&pEvent->cond, &pEvent->lock);
-		}
-		/* Timed wait */
-		else 
-		{
-			struct timespec abstm;
+		OSA_deadlineTime(&abstm, deadline);
+		pabstm = &abstm;
+	}
 
-	 		/* Get absolute time */
-			clock_gettime(CLOCK_REALTIME, &abstm);
-			abstm.tv_sec  += (tminms / 1000);
-			abstm.tv_nsec += (tminms % 1000 * 1000000);
-			status = pthread_cond_timedwait(&pEvent->cond, &pEvent->lock, &abstm);
-		}
+	status = (int)syscall(SYS_futex, addr, FUTEX_WAIT_BITSET_PRIVATE, 
+	                      val, pabstm, NULL, FUTEX_BITSET_MATCH_ANY);
+
+	/* the word already changed is not a block */
+	error = errno;
+	if ((status == 0) || (error != EAGAIN))
+	{
+		if ((status != 0) && (error == ETIMEDOUT)) OSA_statWakeup( deadline );
+		OSA_statBlocked( since );
+		errno = error;
 	}
-	pEvent->flag = 0;
-	pthread_mutex_unlock(&pEvent->lock);
-	
-	return (status ? ERROR : OK);
+
+	return status;
 }
 
-/* 
-// eventSet - set the osa flag(s)
-//
-// Sets the osa flag, if any thread is waiting on the flag(s), wake up it.
+/*
+// OSA_futexWake - wake up tasks pending on a futex word of this process
 //
-// RETURNS: OK if success, otherwize ERROR.
+// RETURNS: number of tasks woken up, or -1 if failed.
 */
-STATUS
-eventSet( HANDLE handle )
+int 
+OSA_futexWake( volatile INT32 *addr, int count )
 {
-	OSEvent* pEvent = (OSEvent*)handle;
-	int status = OK;
-
-	if (pEvent == NULL) return ERROR;
-
-	pthread_mutex_lock(&pEvent->lock);
-	pEvent->flag = 1;
-	status = pthread_cond_signal(&pEvent->cond);
-	pthread_mutex_unlock(&pEvent->lock);
-
-	return status;
+	return (int)syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
 }
 
-/* 
-// eventClear - clear osa flag(s).
+/*
+// OSA_spinBudget - get the spin budget of a wait object
 //
-// Clears specific the osa flag(s).
+// Spinning only pays when the task to hand over runs on another cpu, 
+// objects never spin on a uniprocessor.
 //
-// RETURNS: N/A.
+// RETURNS: number of spin rounds, 0 if the object never spins.
 */
-void
-eventClear( HANDLE handle )
+int 
+OSA_spinBudget( BOOL adaptive, int spin )
 {
-	OSEvent* pEvent = (OSEvent*)handle;
+	if (!adaptive || (sysconf(_SC_NPROCESSORS_ONLN) < 2)) return 0;
 
-	if (pEvent == NULL) return;
-
-	pthread_mutex_lock(&pEvent->lock);
-	pEvent->flag = 0;
-	pthread_mutex_unlock(&pEvent->lock);
+	return (spin > 0) ? spin : OSA_SPIN_DEFAULT;
 }
 
-/* 
-// eventIsSet - check if the osa flag(s) is set
+/*
+// OSA_spinFor - spin while a word of a wait object is below <min>
 //
-// Checks if specific the osa flag(s) is set.
+// This routine polls *<addr> for up to <spin> rounds with a cpu relax hint
+// in between, so that a hand-off between tasks on dedicated cores avoids
+// the sleep and wakeup through the kernel.  The outcome is counted in 
+// <pStats>.
 //
-// RETURNS: TRUE if flag is set, otherwize FALSE.
+// RETURNS: TRUE if *addr reached <min> while spinning, otherwize FALSE.
 */
 BOOL 
-eventIsSet( HANDLE handle )
+OSA_spinFor( volatile INT32 *addr, INT32 min, int spin, OSA_SPIN_STATS *pStats )
 {
-	OSEvent* pEvent = (OSEvent*)handle;
-	BOOL done = FALSE;
+	BOOL hit = FALSE;
 
-	if (pEvent == NULL) return FALSE;
-	
-	pthread_mutex_lock(&pEvent->lock);
-	done = (pEvent->flag == 1);
-	pthread_mutex_unlock(&pEvent->lock);
-	
-	return done;    
+	while ((spin-- > 0) && !hit)
+	{
+		OSA_CPU_RELAX();
+		hit = (__atomic_load_n(addr, __ATOMIC_RELAXED) >= min);
+	}
+
+	__atomic_add_fetch(&pStats->spins, 1, __ATOMIC_RELAXED);
+	if (hit)
+		__atomic_add_fetch(&pStats->spinHits, 1, __ATOMIC_RELAXED);
+
+	return hit;
 }
 
-/********************************************************************************
-// L I N U X  M E S S A G E  Q U E U E  R O U T I N E S
-********************************************************************************/
-/* message node typedefs */
-typedef struct MSG_NODE
+/*
+// OSA_spinStats - get a snapshot of spin statistics of a wait object
+//
+// RETURNS: N/A.
+*/
+void 
+OSA_spinStats( OSA_SPIN_STATS *pStats, OSA_SPIN_STATS *stats )
 {
-    SL_NODE node; /* queue node */
-    int	  msgLen; /* number of bytes of data */
+	stats->spins    = __atomic_load_n(&pStats->spins, __ATOMIC_RELAXED);
+	stats->spinHits = __atomic_load_n(&pStats->spinHits, __ATOMIC_RELAXED);
+	stats->blocks   = __atomic_load_n(&pStats->blocks, __ATOMIC_RELAXED);
 }
-MSG_NODE;
-
-#define MSG_NODE_DATA(pNode) (((char*)pNode) + sizeof(MSG_NODE))
-
-/* macros */
 
-/* The following macro determines the number of bytes needed to buffer
- * a message of the specified length.  The node size is rounded up for
- * efficiency.  The total buffer space required for a pool for
- * <maxMsgs> messages each of up to <maxMsgLen> bytes is:
- *
- *    maxMsgs * MSG_NODE_SIZE (msgLen)
- */
-#define MSG_NODE_SIZE(msgLen) \
-	(ROUND_UP((sizeof (MSG_NODE) + msgLen), sizeof(void*)))
-	
 /*
-// mqInit - initialize a message queue
+// Read a small sysfs file as a string.
 //
-// This routine initializes a message queue data structure.  Like mqCreate()
-// the resulting message queue is capable of holding up to <maxMsgs> messages,
-// each of up to <maxMsgLen> bytes long.
-//
-// RETURNS: OK if success, otherwize ERROR.
+// RETURNS: number of bytes read, or ERROR if failed.
 */
-LOCAL STATUS
-mqInit( HANDLE handle, int maxMsgs, int maxMsgLen )
+LOCAL int osaReadSysfs( const char *path, char *buffer, int size )
 {
-    void* pool    = NULL;
-	OSMessageQueue* pMsgQ = (OSMessageQueue*)handle;
-    int	size      = (int) maxMsgs * MSG_NODE_SIZE(maxMsgLen);
-    int nodeSize  = MSG_NODE_SIZE (maxMsgLen);
-	int ix        = 0;
-	int status    = OK;
-	
-	/* clear out msg q structure */
-	bfillBytes( (char*) pMsgQ, sizeof (*pMsgQ), 0 );
+	int fd, nread;
 
-	status |= pthread_mutex_init(&pMsgQ->lock,  NULL);
-	status |= pthread_cond_init(&pMsgQ->condrd, NULL);
-	status |= pthread_cond_init(&pMsgQ->condwr, NULL); 
-	if (status) return ERROR;
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return ERROR;
 
-	pool = (void*)MEMNEW(size);
-	if(pool == NULL) return ERROR;
+	nread = (int)read(fd, buffer, size - 1);
+	close(fd);
+	if (nread < 0) return ERROR;
 
-    /* initialize internal message queues */
-	sllInit( &pMsgQ->qReady );
-	sllInit( &pMsgQ->qFree );
-	
-	pMsgQ->msgPool = pool;
+	buffer[nread] = 0;
 
-    /* put msg nodes on free list */
-    for (ix = 0; ix < maxMsgs; ix++) 
-	{
-		sllPutAtTail( &pMsgQ->qFree, (SL_NODE*)pool );
-		pool = (void*)(((char*)pool) + nodeSize);
-	}
+	return nread;
+}
 
-    /* initialize rest of msg q */
-	pMsgQ->maxMsgs    = maxMsgs;
-	pMsgQ->maxMsgLen = maxMsgLen;
+/*
+// OSA_nowNs - get the monotonic clock
+//
+// RETURNS: nanoseconds of CLOCK_MONOTONIC.
+*/
+UINT64 
+OSA_nowNs( void )
+{
+	struct timespec now;
 
-	return OK;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (UINT64)now.tv_sec * 1000000000ULL + (UINT64)now.tv_nsec;
 }
 
 /*
-// mqCleanup - cleanup message queue
+// OSA_coarseNs - get the coarse monotonic clock
 //
-// This routine cleanups a static message queue that was initialized with
-// mqInit().
+// The kernel keeps the time of the last tick in the vDSO, reading it takes
+// no hardware counter.  Resolution is a scheduler tick.
 //
-// RETURNS: N/A.
+// RETURNS: nanoseconds of CLOCK_MONOTONIC_COARSE.
 */
-LOCAL void
-mqCleanup( HANDLE handle )
+UINT64 
+OSA_coarseNs( void )
 {
-	OSMessageQueue* pMsgQ = (OSMessageQueue*)handle;
-	int nmsgs = 0;
+	struct timespec now;
 
-	while (nmsgs < pMsgQ->maxMsgs) 
-    {
-		while (sllGet(&pMsgQ->qFree) != NULL)
-			nmsgs++;
-		while (sllGet(&pMsgQ->qReady) != NULL)
-			nmsgs++;
-	}
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
 
-	if(pMsgQ->msgPool != NULL)
-		MEMDEL(pMsgQ->msgPool);
+	return (UINT64)now.tv_sec * 1000000000ULL + (UINT64)now.tv_nsec;
+}
 
-	pthread_cond_destroy(&pMsgQ->condrd);
-	pthread_cond_destroy(&pMsgQ->condwr);
-	pthread_mutex_destroy(&pMsgQ->lock); 
+#define FAST_CLOCK_UNKNOWN 0 /* not calibrated yet */
+#define FAST_CLOCK_COUNTER 1 /* cpu counter scaled to nanoseconds */
+#define FAST_CLOCK_VDSO    2 /* clock_gettime of vDSO */
+
+#define FAST_CLOCK_CALIBRATE_NS 10000000ULL /* 10ms */
+
+LOCAL pthread_once_t fastClockOnce = PTHREAD_ONCE_INIT;
+LOCAL volatile int fastClock = FAST_CLOCK_UNKNOWN;
+LOCAL UINT64 fastCounterBase; /* counter at calibration */
+LOCAL UINT64 fastNsBase; /* CLOCK_MONOTONIC at calibration */
+LOCAL UINT64 fastMult; /* nanoseconds per count, 32.32 fixed point */
+
+/*
+// Read the free-running cpu counter, 0 if there is none.
+//
+// RETURNS: count.
+*/
+LOCAL inline UINT64 osaCounter( void )
+{
+#if defined(__x86_64__)
+	return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+	UINT64 cnt;
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(cnt));
+	return cnt;
+#else
+	return 0;
+#endif
 }
 
 /*
-// mqCreate - create and initialize a message queue
+// Read the monotonic clock and the cpu counter as one pair.
 //
-// This routine creates a message queue capable of holding up to <maxMsgs>
-// messages, each up to <maxMsgLen> bytes long.  The routine returns 
-// a message queue ID used to identify the created message queue in all 
-// subsequent calls to routines in this library. 
+// The clock read is bracketed by two counter reads, the tightest bracket
+// of a few tries gives the counter at the middle of the clock read.
 //
-// RETURNS: Handle to message queue, or NULL if error.
+// RETURNS: N/A.
 */
-HANDLE
-mqCreate( int maxMsgs, int maxMsgLen )
+LOCAL void osaFastClockSample( UINT64 *pNs, UINT64 *pCount )
 {
-	HANDLE handle = (HANDLE)MEMNEW(sizeof(OSMessageQueue));
-	
-    if (handle == NULL) return (NULL);
-    
-	if (mqInit( handle, maxMsgs, maxMsgLen ) != OK) 
+	UINT64 c0, c1, ns, best = ~0ULL;
+	int i;
+
+	*pNs = *pCount = 0;
+	for (i = 0; i < 8; i++)
 	{
-		MEMDEL( handle );
-		return (NULL);
-	}
+		c0 = osaCounter();
+		ns = OSA_nowNs();
+		c1 = osaCounter();
+		if (c1 - c0 >= best) continue;
 
-    return handle;
+		best    = c1 - c0;
+		*pNs    = ns;
+		*pCount = c0 + (c1 - c0) / 2;
+	}
 }
 
 /*
-// mqDelete - delete a message queue
+// Calibrate the fast clock once.
 //
-// This routine deletes a message queue.
+// The TSC is used only if it is invariant and the kernel keeps it as its
+// clocksource, so that it runs at a constant rate synchronized on all 
+// cpus.  The arm64 generic timer always does, at the rate of cntfrq_el0.
 //
 // RETURNS: N/A.
 */
-void
-mqDelete( HANDLE handle )
+LOCAL void osaFastClockInit( void )
 {
-	if (handle==NULL) return;
-	
-	mqCleanup( handle );
-	MEMDEL((char*)handle);
-	handle = NULL;
+	UINT64 t0, t1, c0, c1;
+	int clock = FAST_CLOCK_VDSO;
+#if defined(__x86_64__)
+	unsigned int eax, ebx, ecx, edx;
+	char source[32];
+
+	if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1 << 8)) &&
+	    (osaReadSysfs( "/sys/devices/system/clocksource/clocksource0/"
+	                   "current_clocksource", source, sizeof(source) ) > 0) &&
+	    (strncmp(source, "tsc", 3) == 0))
+	{
+		osaFastClockSample( &t0, &c0 );
+		do
+			osaFastClockSample( &t1, &c1 );
+		while (t1 - t0 < FAST_CLOCK_CALIBRATE_NS);
+
+		fastMult = (UINT64)(((unsigned __int128)(t1 - t0) << 32) / (c1 - c0));
+		fastCounterBase = c1;
+		fastNsBase = t1;
+		clock = FAST_CLOCK_COUNTER;
+	}
+#elif defined(__aarch64__)
+	UINT64 freq;
+
+	__asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(freq));
+	if (freq != 0)
+	{
+		osaFastClockSample( &t0, &c0 );
+		fastMult = (UINT64)((1000000000ULL << 32) / freq);
+		fastCounterBase = c0;
+		fastNsBase = t0;
+		clock = FAST_CLOCK_COUNTER;
+	}
+	(void)t1; (void)c1;
+#else
+	(void)t0; (void)t1; (void)c0; (void)c1;
+#endif
+
+	__atomic_store_n(&fastClock, clock, __ATOMIC_RELEASE);
 }
 
 /*
-// mqSend - send a message to a message queue
+// OSA_fastNs - get the fast clock
 //
-// This routine sends the message in <buffer> of length <nBytes> to the message
-// queue <pMsgQ>.  
+// Reads the cpu counter and scales it to nanoseconds, or falls back to
+// OSA_nowNs.  The first call calibrates for 10ms, OSA_init does it before
+// any task runs.  The rate is never calibrated again, while NTP slews
+// CLOCK_MONOTONIC, so the time drifts away from OSA_nowNs, and is only
+// good for intervals between two OSA_fastNs readings.
 //
-// RETURNS: number of bytes received, or ERROR if failed.
+// RETURNS: nanoseconds.
 */
-int 
-mqSend( HANDLE handle, char *buffer, int nbytes, int tminms, int priority )
+UINT64 
+OSA_fastNs( void )
 {
-    MSG_NODE* p_msg;
-	OSMessageQueue* pMsgQ = (OSMessageQueue*)handle;
-	int status = OK;
+	int clock = __atomic_load_n(&fastClock, __ATOMIC_ACQUIRE);
 
-	if((pMsgQ == NULL) || (nbytes > pMsgQ->maxMsgLen))
-		return ERROR;
+	if (__builtin_expect(clock == FAST_CLOCK_COUNTER, 1))
+	{
+#if defined(__x86_64__) || defined(__aarch64__)
+		return fastNsBase + (UINT64)(((unsigned __int128)(osaCounter() - 
+		                     fastCounterBase) * fastMult) >> 32);
+#endif
+	}
 
-	pthread_mutex_lock(&pMsgQ->lock);
-	while(1) 
-    {
-		p_msg = (MSG_NODE*)sllGet( &pMsgQ->qFree );
-		if (p_msg == NULL) 
-        {
-			/* Non-blocking wait, set EAGAIN if message queue is empty.	*/
-			if(tminms == NO_WAIT) 
-            {
-				status = ERROR;
-			}
-			/* Blocking wait */
-			else if (tminms == WAIT_FOREVER) 
-            {
-				status = pthread_cond_wait(&pMsgQ->condwr, &pMsgQ->lock);
-			}
-			/* Timed wait */
-			else 
-            {
-				struct timespec abstm;
-
-		        clock_gettime(CLOCK_REALTIME, &abstm);
-		        abstm.tv_sec  += (tminms / 1000);
-		        abstm.tv_nsec += (tminms % 1000 * 1000000);
-		        status = pthread_cond_timedwait(&pMsgQ->condwr, &pMsgQ->lock, &abstm);
-			}
-			/* Any errors occur, return with errno. */
-		    if (status) break;
-		}
-		else 
-        {
-			bcopyBytes( buffer, MSG_NODE_DATA(p_msg), nbytes );
-			if (priority != MSG_PRI_NORMAL)
-				sllPutAtHead( &pMsgQ->qReady, (SL_NODE*)p_msg );
-			else
-				sllPutAtTail( &pMsgQ->qReady, (SL_NODE*)p_msg );
-				
-			p_msg->msgLen = nbytes;
-			status = pthread_cond_signal(&pMsgQ->condrd);
-			break;
-		}
+	if (clock == FAST_CLOCK_UNKNOWN)
+	{
+		pthread_once(&fastClockOnce, osaFastClockInit);
+		return OSA_fastNs();
 	}
-	pthread_mutex_unlock(&pMsgQ->lock);
 
-	return (status ? ERROR : nbytes);
+	return OSA_nowNs();
 }
 
+/* statistics of the calling task, or of a thread not created by tskCreate */
+LOCAL __thread OSTaskStats *osaStatsSelf;
+LOCAL __thread OSTaskStats osaStatsLocal;
+
 /*
-// mqReceive - receive a message from a message queue
+// Get the statistics of the calling task.
 //
-// This routine receives a message from the message queue <pMsgQ>.
-// The received message is copied into the specified <buffer>, which is
-// <maxNBytes> in length.  If the message is longer than <maxNBytes>,
-// the remainder of the message is discarded (no error indication
-// is returned).
-//
-// RETURNS: number of bytes received, or ERROR if failed.
+// RETURNS: pointer to statistics.
 */
-int
+LOCAL OSTaskStats *osaStats( void )
+{
+	return (osaStatsSelf != NULL) ? osaStatsSelf : &osaStatsLocal;
+}
+
+/*
+// OSA_statBlocked - account a block in an osa primitive
+//
+// Adds the time from <since> to now to the blocked time of the calling
+// task.  Only the task writes its statistics, others just read them.
+//
+// RETURNS: N/A.
+*/
+void 
+OSA_statBlocked( UINT64 since )
+{
+	OSTaskStats *pStats = osaStats();
+
+	__atomic_fetch_add(&pStats->blockedTime, OSA_fastNs() - since, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&pStats->blocks, 1, __ATOMIC_RELAXED);
+}
+
+/*
+// OSA_statWakeup - account a timed wakeup
+//
+// Adds the lateness of the calling task waking up after <deadline> to its
+// latency histogram, bucket n for lateness below 2^n microseconds.
+//
+// RETURNS: N/A.
+*/
+void 
+OSA_statWakeup( UINT64 deadline )
+{
+	OSTaskStats *pStats = osaStats();
+	UINT64 now = OSA_nowNs();
+	UINT64 late = (now > deadline) ? (now - deadline) : 0;
+	int bucket = 0;
+
+	if (late >= 1000)
+		bucket = 64 - __builtin_clzll(late / 1000);
+	if (bucket >= TSK_LATENCY_BUCKETS)
+		bucket = TSK_LATENCY_BUCKETS - 1;
+
+	__atomic_fetch_add(&pStats->latency[bucket], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&pStats->wakeups, 1, __ATOMIC_RELAXED);
+	if (late > __atomic_load_n(&pStats->latencyMax, __ATOMIC_RELAXED))
+		__atomic_store_n(&pStats->latencyMax, late, __ATOMIC_RELAXED);
+}
+
+/*
+// OSA_delay - Delay time in milliseconds.
+//
+// RETURNS: N/A.
+*/
+void 
+OSA_delay( UINT32 msecs )
+{
+	OSA_delayNs( (UINT64)msecs * 1000000ULL );
+}
+
+/*
+// OSA_delayNs - Delay time in nanoseconds.
+//
+// Sleeps until an absolute CLOCK_MONOTONIC time, signals never shorten 
+// nor stretch the delay.
+//
+// RETURNS: N/A.
+*/
+void 
+OSA_delayNs( UINT64 nsecs )
+{
+	struct timespec abstm;
+	UINT64 deadline = OSA_nowNs() + nsecs;
+
+	OSA_deadlineTime(&abstm, deadline);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &abstm, NULL) == EINTR)
+		;
+
+	OSA_statWakeup( deadline );
+}
+
+/*
+// OSA_delayUs - Delay time in microseconds.
+//
+// RETURNS: N/A.
+*/
+void 
+OSA_delayUs( UINT32 usecs )
+{
+	OSA_delayNs( (UINT64)usecs * 1000ULL );
+}
+
+/********************************************************************************
+// L I N U X  E V E N T  R O U T I N E S
+********************************************************************************/
+/* event state word, flag bit and pulse generation above it */
+#define EVENT_FLAG  0x1
+#define EVENT_PULSE 0x2
+
+/*
+// eventCreate - create and initialize a osa flag
+//
+// This routine creates a osa flag. 
+//
+// RETURNS: Handle to OS flag, or NULL if error.
+*/
+HANDLE
+eventCreate( void )
+{
+	return eventCreateEx( 0, 0 );
+}
+
+/*
+// eventCreateEx - create and initialize a osa flag with options
+//
+// The flag is a futex word, so that waiters need no lock and a broadcast
+// releases all of them at once.  With EVENT_OPT_MANUAL the flag stays set
+// until eventClear(), and eventSet() releases every waiter.  With 
+// EVENT_OPT_ADAPTIVE a waiter polls the flag for <spin> rounds, or
+// OSA_SPIN_DEFAULT rounds if <spin> is 0, before it sleeps.
+//
+// RETURNS: Handle to OS flag, or NULL if error.
+*/
+HANDLE
+eventCreateEx( int options, int spin )
+{
+	OSEvent* pEvent = (OSEvent*)MEMNEW(sizeof(OSEvent));
+	
+    if (pEvent == NULL) return (NULL);
+    
+	bfillBytes( (char*) pEvent, sizeof (*pEvent), 0 );
+	pEvent->options = options;
+	pEvent->spin    = OSA_spinBudget( (options & EVENT_OPT_ADAPTIVE) != 0, spin );
+
+    return (HANDLE)pEvent;
+}
+
+/*
+// eventDelete - delete a osa flag.
+//
+// This routine deletes a osa flag.
+//
+// RETURNS: N/A.
+*/
+void
+eventDelete( HANDLE handle )
+{
+	OSEvent* pEvent = (OSEvent*)handle;
+	
+	if (pEvent==NULL) return;
+	
+	pEvent->state = 0;
+
+	MEMDEL((char*)pEvent);
+}
+
+/* 
+// eventTake - check whether a waiter of a osa flag is released
+//
+// A waiter is released if the flag is set, it is cleared then unless the
+// flag is manual-reset, or if the flag was pulsed since the waiter came,
+// that is the generation differs from <gen>.
+//
+// RETURNS: TRUE if released, otherwize FALSE with <*pState> checked.
+*/
+LOCAL BOOL
+eventTake( OSEvent* pEvent, INT32 gen, INT32 *pState )
+{
+	INT32 state = __atomic_load_n(&pEvent->state, __ATOMIC_SEQ_CST);
+
+	for (;;)
+	{
+		if (!(state & EVENT_FLAG))
+		{
+			*pState = state;
+			return ((state & ~EVENT_FLAG) != gen);
+		}
+		if (pEvent->options & EVENT_OPT_MANUAL) 
+			return TRUE;
+		if (__atomic_compare_exchange_n(&pEvent->state, &state, state & ~EVENT_FLAG, TRUE, 
+		                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+			return TRUE;
+	}
+}
+
+/* 
+// eventWait - wait a osa flag(s) with mode and timeout.
+//
+// RETURNS: OK if success, otherwize ERROR.
+*/
+STATUS 
+eventWait( HANDLE handle, int tminms )
+{
+	return eventWaitUntil( handle, OSA_deadline(tminms) );
+}
+
+/* 
+// eventWaitUntil - wait a osa flag until an absolute deadline
+//
+// A waiter registers itself before it checks the flag again and sleeps
+// on the state word, so that eventSet() either is seen by the check,
+// or finds the waiter and wakes it up.
+//
+// RETURNS: OK if success, otherwize ERROR.
+*/
+STATUS 
+eventWaitUntil( HANDLE handle, UINT64 deadline )
+{
+	OSEvent* pEvent = (OSEvent*)handle;
+	INT32 gen, state;
+	BOOL released;
+	int spin, status = 0;
+
+	if (pEvent == NULL) return ERROR;
+
+	gen = __atomic_load_n(&pEvent->state, __ATOMIC_SEQ_CST) & ~EVENT_FLAG;
+	if (eventTake( pEvent, gen, &state )) return OK;
+	if (deadline == DEADLINE_NO_WAIT) return ERROR;
+
+	if (pEvent->spin > 0)
+	{
+		for (spin = pEvent->spin; spin > 0; spin--)
+		{
+			OSA_CPU_RELAX();
+			if (__atomic_load_n(&pEvent->state, __ATOMIC_RELAXED) != state) break;
+		}
+		__atomic_add_fetch(&pEvent->spinStats.spins, 1, __ATOMIC_RELAXED);
+		if ((spin > 0) && eventTake( pEvent, gen, &state ))
+		{
+			__atomic_add_fetch(&pEvent->spinStats.spinHits, 1, __ATOMIC_RELAXED);
+			return OK;
+		}
+	}
+
+	for (;;)
+	{
+		__atomic_add_fetch(&pEvent->waiters, 1, __ATOMIC_SEQ_CST);
+		released = eventTake( pEvent, gen, &state );
+		status   = 0;
+		if (!released)
+		{
+			if (pEvent->spin > 0)
+				__atomic_add_fetch(&pEvent->spinStats.blocks, 1, __ATOMIC_RELAXED);
+			status = OSA_futexWait(&pEvent->state, state, deadline);
+		}
+		__atomic_sub_fetch(&pEvent->waiters, 1, __ATOMIC_RELAXED);
+
+		if (released || eventTake( pEvent, gen, &state )) return OK;
+		if ((status != 0) && (errno == ETIMEDOUT)) return ERROR;
+	}
+}
+
+/* 
+// eventSet - set the osa flag(s)
+//
+// Sets the osa flag, if any thread is waiting on the flag(s), wake up it,
+// or all of them if the flag is manual-reset.  Nobody is woken up while 
+// nobody waits.
+//
+// RETURNS: OK if success, otherwize ERROR.
+*/
+STATUS
+eventSet( HANDLE handle )
+{
+	OSEvent* pEvent = (OSEvent*)handle;
+
+	if (pEvent == NULL) return ERROR;
+
+	__atomic_fetch_or(&pEvent->state, EVENT_FLAG, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pEvent->waiters, __ATOMIC_SEQ_CST) > 0)
+	{
+		if (OSA_futexWake(&pEvent->state, 
+		                  (pEvent->options & EVENT_OPT_MANUAL) ? INT32_MAX : 1) < 0)
+			return ERROR;
+	}
+
+	return OK;
+}
+
+/* 
+// eventPulse - release all tasks waiting on the osa flag
+//
+// Every task waiting now is released with one wakeup, the flag itself 
+// is left as it is, so that tasks coming later still wait.
+//
+// RETURNS: OK if success, otherwize ERROR.
+*/
+STATUS
+eventPulse( HANDLE handle )
+{
+	OSEvent* pEvent = (OSEvent*)handle;
+
+	if (pEvent == NULL) return ERROR;
+
+	__atomic_add_fetch(&pEvent->state, EVENT_PULSE, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pEvent->waiters, __ATOMIC_SEQ_CST) > 0)
+	{
+		if (OSA_futexWake(&pEvent->state, INT32_MAX) < 0)
+			return ERROR;
+	}
+
+	return OK;
+}
+
+/* 
+// eventClear - clear osa flag(s).
+//
+// Clears specific the osa flag(s).
+//
+// RETURNS: N/A.
+*/
+void
+eventClear( HANDLE handle )
+{
+	OSEvent* pEvent = (OSEvent*)handle;
+
+	if (pEvent == NULL) return;
+
+	__atomic_fetch_and(&pEvent->state, ~EVENT_FLAG, __ATOMIC_SEQ_CST);
+}
+
+/* 
+// eventIsSet - check if the osa flag(s) is set
+//
+// Checks if specific the osa flag(s) is set.
+//
+// RETURNS: TRUE if flag is set, otherwize FALSE.
+*/
+BOOL 
+eventIsSet( HANDLE handle )
+{
+	OSEvent* pEvent = (OSEvent*)handle;
+
+	if (pEvent == NULL) return FALSE;
+	
+	return (__atomic_load_n(&pEvent->state, __ATOMIC_ACQUIRE) & EVENT_FLAG) != 0;
+}
+
+/* 
+// eventGetSpinStats - get spin statistics of an adaptive osa flag
+//
+// RETURNS: OK if success, otherwize ERROR.
+*/
+STATUS 
+eventGetSpinStats( HANDLE handle, OSA_SPIN_STATS *stats )
+{
+	OSEvent* pEvent = (OSEvent*)handle;
+
+	if ((pEvent == NULL) || (stats == NULL)) return ERROR;
+
+	OSA_spinStats( &pEvent->spinStats, stats );
+
+	return OK;
+}
+
+/********************************************************************************
+// L I N U X  E V E N T  G R O U P  R O U T I N E S
+********************************************************************************/
+/*
+// eventGroupCreate - create and initialize an event group
+//
+// This routine creates an event group of 32 flag bits, all cleared.  The
+// bits are a single futex word, setting bits nobody waits for costs one
+// atomic operation.
+//
+// RETURNS: Handle to event group, or NULL if error.
+*/
+HANDLE
+eventGroupCreate( void )
+{
+	OSEventGroup* pGroup = (OSEventGroup*)MEMNEW(sizeof(OSEventGroup));
+	
+    if (pGroup == NULL) return (NULL);
+    
+	bfillBytes( (char*) pGroup, sizeof (*pGroup), 0 );
+
+    return (HANDLE)pGroup;
+}
+
+/*
+// eventGroupDelete - delete an event group
+//
+// RETURNS: N/A.
+*/
+void
+eventGroupDelete( HANDLE handle )
+{
+	if (handle == NULL) return;
+
+	MEMDEL((char*)handle);
+}
+
+/* 
+// eventSetBits - set flag bits of an event group
+//
+// All tasks pending on the group are woken up to check their masks, only
+// if some bit was really set.
+//
+// RETURNS: OK if success, otherwize ERROR.
+*/
+STATUS
+eventSetBits( HANDLE handle, UINT32 bits )
+{
+	OSEventGroup* pGroup = (OSEventGroup*)handle;
+	UINT32 old;
+
+	if (pGroup == NULL) return ERROR;
+
+	old = (UINT32)__atomic_fetch_or(&pGroup->bits, (INT32)bits, __ATOMIC_SEQ_CST);
+	if (((old | bits) != old) && (__atomic_load_n(&pGroup->waiters, __ATOMIC_SEQ_CST) > 0))
+	{
+		if (OSA_futexWake(&pGroup->bits, INT32_MAX) < 0)
+			return ERROR;
+	}
+
+	return OK;
+}
+
+/* 
+// eventClearBits - clear flag bits of an event group
+//
+// RETURNS: OK if success, otherwize ERROR.
+*/
+STATUS
+eventClearBits( HANDLE handle, UINT32 bits )
+{
+	OSEventGroup* pGroup = (OSEventGroup*)handle;
+
+	if (pGroup == NULL) return ERROR;
+
+	__atomic_fetch_and(&pGroup->bits, (INT32)~bits, __ATOMIC_SEQ_CST);
+
+	return OK;
+}
+
+/* 
+// eventGetBits - get flag bits of an event group
+//
+// RETURNS: flag bits currently set.
+*/
+UINT32
+eventGetBits( HANDLE handle )
+{
+	OSEventGroup* pGroup = (OSEventGroup*)handle;
+
+	if (pGroup == NULL) return 0;
+
+	return (UINT32)__atomic_load_n(&pGroup->bits, __ATOMIC_ACQUIRE);
+}
+
+/* 
+// eventTakeBits - check the flag bits of an event group against a mask
+//
+// With EVENT_WAIT_ANY one bit of <mask> is enough, with EVENT_WAIT_ALL 
+// every bit of <mask> must be set.  The bits of <mask> are cleared 
+// atomically with the check if <clearOnExit>.
+//
+// RETURNS: bits of <mask> set, or 0 if not satisfied, <*pBits> is the
+// flag bits checked.
+*/
+LOCAL UINT32
+eventTakeBits( OSEventGroup* pGroup, UINT32 mask, int mode, BOOL clearOnExit, INT32 *pBits )
+{
+	INT32 bits = __atomic_load_n(&pGroup->bits, __ATOMIC_SEQ_CST);
+	UINT32 hit;
+
+	for (;;)
+	{
+		hit = (UINT32)bits & mask;
+		if ((mode == EVENT_WAIT_ALL) ? (hit != mask) : (hit == 0))
+			break;
+		if (!clearOnExit) 
+			return hit;
+		if (__atomic_compare_exchange_n(&pGroup->bits, &bits, bits & (INT32)~mask, TRUE, 
+		                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+			return hit;
+	}
+
+	*pBits = bits;
+
+	return 0;
+}
+
+/* 
+// eventWaitBits - wait flag bits of an event group with mode and timeout.
+//
+// RETURNS: bits of <mask> set when satisfied, or 0 if timeout or error.
+*/
+UINT32 
+eventWaitBits( HANDLE handle, UINT32 mask, int mode, BOOL clearOnExit, int tminms )
+{
+	return eventWaitBitsUntil( handle, mask, mode, clearOnExit, OSA_deadline(tminms) );
+}
+
+/* 
+// eventWaitBitsUntil - wait flag bits of an event group until a deadline.
+//
+// A waiter registers itself before it checks the bits again and sleeps
+// on the bits word, so that setting bits either is seen by the check,
+// or finds the waiter and wakes it up.
+//
+// RETURNS: bits of <mask> set when satisfied, or 0 if timeout or error.
+*/
+UINT32 
+eventWaitBitsUntil( HANDLE handle, UINT32 mask, int mode, BOOL clearOnExit, UINT64 deadline )
+{
+	OSEventGroup* pGroup = (OSEventGroup*)handle;
+	UINT32 hit;
+	INT32 bits = 0;
+	int status;
+
+	if ((pGroup == NULL) || (mask == 0)) return 0;
+
+	hit = eventTakeBits( pGroup, mask, mode, clearOnExit, &bits );
+	if ((hit != 0) || (deadline == DEADLINE_NO_WAIT)) return hit;
+
+	for (;;)
+	{
+		__atomic_add_fetch(&pGroup->waiters, 1, __ATOMIC_SEQ_CST);
+		hit = eventTakeBits( pGroup, mask, mode, clearOnExit, &bits );
+		status = (hit == 0) ? OSA_futexWait(&pGroup->bits, bits, deadline) : 0;
+		__atomic_sub_fetch(&pGroup->waiters, 1, __ATOMIC_RELAXED);
+
+		if (hit == 0)
+			hit = eventTakeBits( pGroup, mask, mode, clearOnExit, &bits );
+		if ((hit != 0) || ((status != 0) && (errno == ETIMEDOUT)))
+			return hit;
+	}
+}
+
+/********************************************************************************
+// L I N U X  M E S S A G E  Q U E U E  R O U T I N E S
+********************************************************************************/
+/* message node typedefs */
+typedef struct MSG_NODE
+{
+    SL_NODE node; /* queue node */
+    int	  msgLen; /* number of bytes of data */
+    int msgClass; /* size class the node belongs to */
+}
+MSG_NODE;
+
+#define MSG_NODE_DATA(pNode) (((char*)pNode) + sizeof(MSG_NODE))
+#define MSG_NODE_OF(buffer)  ((MSG_NODE*)(((char*)buffer) - sizeof(MSG_NODE)))
+
+/* update statistics of locked queue, readers peek them without the lock */
+#define MQ_STAT_ADD(pMsgQ, field, n) \
+	__atomic_store_n(&(pMsgQ)->stats.field, (pMsgQ)->stats.field + (n), __ATOMIC_RELAXED)
+
+/* macros */
+
+/* The following macro determines the number of bytes needed to buffer
+ * a message of the specified length.  The node size is rounded up for
+ * efficiency.  The total buffer space required for a pool for
+ * <maxMsgs> messages each of up to <maxMsgLen> bytes is:
+ *
+ *    maxMsgs * MSG_NODE_SIZE (msgLen)
+ */
+#define MSG_NODE_SIZE(msgLen) \
+	(ROUND_UP((sizeof (MSG_NODE) + msgLen), sizeof(void*)))
+
+/* message slot typedefs of lock-free ring */
+typedef struct MSG_SLOT
+{
+	volatile UINT64 seq; /* sequence number, used by MQ_TYPE_MPMC */
+	INT32        msgLen; /* number of bytes of data */
+	INT32      reserved; /* keep data aligned */
+}
+MSG_SLOT;
+
+#define MSG_SLOT_DATA(pSlot) (((char*)pSlot) + sizeof(MSG_SLOT))
+#define MSG_SLOT_OF(buffer)  ((MSG_SLOT*)(((char*)buffer) - sizeof(MSG_SLOT)))
+
+#define MSG_SLOT_SIZE(msgLen) \
+	(ROUND_UP((sizeof (MSG_SLOT) + msgLen), sizeof(void*)))
+
+#define MSG_RING_SLOT(pRing, index) \
+	((MSG_SLOT*)((pRing)->slotPool + (int)((index) & (pRing)->mask) * (pRing)->slotSize))
+
+/*
+// mqRingInit - initialize the lock-free ring of a message queue
+//
+// The number of slots is rounded up to power of two, so that the free
+// running head and tail indices are mapped to slots by masking.  Every
+// slot of a MQ_TYPE_MPMC ring starts with the sequence number of the
+// index it may be written at.
+//
+// RETURNS: OK if success, otherwize ERROR.
+*/
+LOCAL STATUS
+mqRingInit( OSMessageQueue* pMsgQ, int maxMsgs, int maxMsgLen )
+{
+	OSMessageRing *pRing = &pMsgQ->ring;
+	UINT32 nslots = 1;
+	UINT32 ix;
+
+	if ((maxMsgs <= 0) || (maxMsgs > 0x40000000)) return ERROR;
+	
+	while (nslots < (UINT32)maxMsgs)
+		nslots <<= 1;
+
+	pRing->slotSize = MSG_SLOT_SIZE(maxMsgLen);
+	pRing->mask     = nslots - 1;
+	pRing->slotPool = (char*)MEMNEW(nslots * pRing->slotSize);
+	if (pRing->slotPool == NULL) return ERROR;
+
+	for (ix = 0; ix < nslots; ix++)
+		MSG_RING_SLOT(pRing, ix)->seq = ix;
+
+	pMsgQ->maxMsgs   = (int)nslots;
+	pMsgQ->maxMsgLen = maxMsgLen;
+
+	return OK;
+}
+
+/*
+// mqRingNotify - wake up tasks pending on the ring event
+//
+// The caller has just published <count> indices, the full barrier orders 
+// that store against the load of waiter count, a pending task either sees
+// the new index or is seen here.
+//
+// RETURNS: N/A.
+*/
+LOCAL void
+mqRingNotify( volatile INT32 *event, volatile INT32 *waiters, int count )
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(waiters, __ATOMIC_RELAXED) != 0)
+	{
+		__atomic_add_fetch(event, 1, __ATOMIC_SEQ_CST);
+		OSA_futexWake(event, count);
+	}
+}
+
+/*
+// mqStatHighWater - raise the high-water mark of message queue
+//
+// RETURNS: N/A.
+*/
+LOCAL void
+mqStatHighWater( volatile INT32 *highWater, INT32 depth )
+{
+	INT32 mark = __atomic_load_n(highWater, __ATOMIC_RELAXED);
+
+	while ((depth > mark) && 
+	       !__atomic_compare_exchange_n(highWater, &mark, depth, TRUE, 
+	                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/*
+// mqSpscWritable - check if the producer may fill a slot
+//
+// The producer refreshes its copy of head only when the ring looks full.
+//
+// RETURNS: TRUE if ring is not full, otherwize FALSE.
+*/
+LOCAL BOOL
+mqSpscWritable( OSMessageRing *pRing )
+{
+	UINT64 tail = pRing->tail;
+
+	if (tail - pRing->headCache > pRing->mask)
+	{
+		pRing->headCache = __atomic_load_n(&pRing->head, __ATOMIC_ACQUIRE);
+		if (tail - pRing->headCache > pRing->mask)
+		{
+			mqStatHighWater(&pRing->highWater, (INT32)(pRing->mask + 1));
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/*
+// mqSpscReadable - check if the consumer may drain a slot
+//
+// The consumer refreshes its copy of tail only when the ring looks empty,
+// the depth seen then samples the high-water mark.
+//
+// RETURNS: TRUE if ring is not empty, otherwize FALSE.
+*/
+LOCAL BOOL
+mqSpscReadable( OSMessageRing *pRing )
+{
+	UINT64 head = pRing->head;
+
+	if (head == pRing->tailCache)
+	{
+		pRing->tailCache = __atomic_load_n(&pRing->tail, __ATOMIC_ACQUIRE);
+		if (head == pRing->tailCache)
+			return FALSE;
+		mqStatHighWater(&pRing->highWater, (INT32)(pRing->tailCache - head));
+	}
+
+	return TRUE;
+}
+
+/*
+// mqMpmcWritable - check if a producer may claim a slot
+//
+// RETURNS: TRUE if the slot at tail is free or tail moved, otherwize FALSE.
+*/
+LOCAL BOOL
+mqMpmcWritable( OSMessageRing *pRing )
+{
+	UINT64 pos = __atomic_load_n(&pRing->tail, __ATOMIC_RELAXED);
+	UINT64 seq = __atomic_load_n(&MSG_RING_SLOT(pRing, pos)->seq, __ATOMIC_ACQUIRE);
+
+	return ((INT64)(seq - pos) >= 0) ? TRUE : FALSE;
+}
+
+/*
+// mqMpmcReadable - check if a consumer may claim a slot
+//
+// RETURNS: TRUE if the slot at head is ready or head moved, otherwize FALSE.
+*/
+LOCAL BOOL
+mqMpmcReadable( OSMessageRing *pRing )
+{
+	UINT64 pos = __atomic_load_n(&pRing->head, __ATOMIC_RELAXED);
+	UINT64 seq = __atomic_load_n(&MSG_RING_SLOT(pRing, pos)->seq, __ATOMIC_ACQUIRE);
+
+	return ((INT64)(seq - (pos + 1)) >= 0) ? TRUE : FALSE;
+}
+
+/*
+// mqMpmcClaim - claim the slot at a ring index
+//
+// A slot is free for index <pos> when its sequence number equals <pos>,
+// and ready for reading at <pos> when it equals <pos> + 1. The caller
+// owns the slot once the index is advanced by compare-and-swap.
+//
+// RETURNS: claimed slot, or NULL if ring is full or empty.
+*/
+LOCAL MSG_SLOT*
+mqMpmcClaim( OSMessageRing *pRing, volatile UINT64 *index, UINT64 lag )
+{
+	UINT64 pos = __atomic_load_n(index, __ATOMIC_RELAXED);
+	MSG_SLOT* pSlot;
+	INT64 diff;
+
+	FOREVER
+	{
+		pSlot = MSG_RING_SLOT(pRing, pos);
+		diff  = (INT64)(__atomic_load_n(&pSlot->seq, __ATOMIC_ACQUIRE) - (pos + lag));
+		if (diff == 0)
+		{
+			if (__atomic_compare_exchange_n(index, &pos, pos + 1, TRUE, 
+			                                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				return pSlot;
+		}
+		else if (diff < 0)
+		{
+			return NULL;
+		}
+		else
+		{
+			pos = __atomic_load_n(index, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/*
+// mqRingReserve - reserve a slot to be filled by a producer
+//
+// RETURNS: reserved slot, or NULL if the ring is full.
+*/
+LOCAL MSG_SLOT*
+mqRingReserve( OSMessageQueue* pMsgQ )
+{
+	OSMessageRing *pRing = &pMsgQ->ring;
+
+	if (pMsgQ->type == MQ_TYPE_MPMC)
+		return mqMpmcClaim(pRing, &pRing->tail, 0);
+
+	return mqSpscWritable(pRing) ? MSG_RING_SLOT(pRing, pRing->tail) : NULL;
+}
+
+/*
+// mqRingCommit - publish a slot filled by a producer
+//
+// RETURNS: N/A.
+*/
+LOCAL void
+mqRingCommit( OSMessageQueue* pMsgQ, MSG_SLOT* pSlot )
+{
+	OSMessageRing *pRing = &pMsgQ->ring;
+
+	if (pMsgQ->type == MQ_TYPE_MPMC)
+	{
+		UINT64 head = __atomic_load_n(&pRing->head, __ATOMIC_RELAXED);
+
+		__atomic_store_n(&pSlot->seq, pSlot->seq + 1, __ATOMIC_RELEASE);
+		mqStatHighWater(&pRing->highWater, 
+		                (INT32)(__atomic_load_n(&pRing->tail, __ATOMIC_RELAXED) - head));
+	}
+	else
+	{
+		__atomic_store_n(&pRing->tail, pRing->tail + 1, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+// mqRingPeek - get a slot to be drained by a consumer
+//
+// RETURNS: ready slot, or NULL if the ring is empty.
+*/
+LOCAL MSG_SLOT*
+mqRingPeek( OSMessageQueue* pMsgQ )
+{
+	OSMessageRing *pRing = &pMsgQ->ring;
+
+	if (pMsgQ->type == MQ_TYPE_MPMC)
+		return mqMpmcClaim(pRing, &pRing->head, 1);
+
+	return mqSpscReadable(pRing) ? MSG_RING_SLOT(pRing, pRing->head) : NULL;
+}
+
+/*
+// mqRingRelease - give a drained slot back to producers
+//
+// A MQ_TYPE_MPMC slot read at index pos becomes free for index
+// pos + number of slots.
+//
+// RETURNS: N/A.
+*/
+LOCAL void
+mqRingRelease( OSMessageQueue* pMsgQ, MSG_SLOT* pSlot )
+{
+	OSMessageRing *pRing = &pMsgQ->ring;
+
+	if (pMsgQ->type == MQ_TYPE_MPMC)
+		__atomic_store_n(&pSlot->seq, pSlot->seq + pRing->mask, __ATOMIC_RELEASE);
+	else
+		__atomic_store_n(&pRing->head, pRing->head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+// mqRingPend - pend until the ring event advances
+//
+// The waiter count is raised before <ready> is checked again, see 
+// mqRingNotify().
+//
+// RETURNS: OK if should retry, or ERROR if timeout.
+*/
+LOCAL STATUS
+mqRingPend( OSMessageRing *pRing, volatile INT32 *event, volatile INT32 *waiters,
+            BOOL(*ready)(OSMessageRing*), UINT64 deadline )
+{
+	int status = 0;
+	INT32 seq;
+
+	__atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+	seq = __atomic_load_n(event, __ATOMIC_SEQ_CST);
+	if (!(*ready)(pRing))
+		status = OSA_futexWait(event, seq, deadline);
+	__atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+
+	return ((status != 0) && (errno == ETIMEDOUT)) ? ERROR : OK;
+}
+
+/*
+// mqRingPendWrite - get a slot to be filled by a producer, pend if full
+//
+// RETURNS: reserved slot, or NULL if failed.
+*/
+LOCAL MSG_SLOT*
+mqRingPendWrite( OSMessageQueue* pMsgQ, UINT64 deadline )
+{
+	OSMessageRing *pRing = &pMsgQ->ring;
+	MSG_SLOT* pSlot;
+	UINT64 start = 0;
+
+	while ((pSlot = mqRingReserve(pMsgQ)) == NULL)
+	{
+		if (deadline == DEADLINE_NO_WAIT) break;
+		if (start == 0)
+		{
+			start = OSA_nowNs();
+			__atomic_add_fetch(&pMsgQ->stats.blockedSends, 1, __ATOMIC_RELAXED);
+		}
+		if (mqRingPend(pRing, &pRing->wrEvent, &pRing->wrWaiters, 
+		               (pMsgQ->type == MQ_TYPE_MPMC) ? mqMpmcWritable : mqSpscWritable,
+		               deadline) != OK)
+			break;
+	}
+
+	if (start != 0)
+		__atomic_add_fetch(&pMsgQ->stats.sendBlockedNs, OSA_nowNs() - start, __ATOMIC_RELAXED);
+
+	return pSlot;
+}
+
+/*
+// mqRingPendRead - get a slot to be drained by a consumer, pend if empty
+//
+// RETURNS: ready slot, or NULL if failed.
+*/
+LOCAL MSG_SLOT*
+mqRingPendRead( OSMessageQueue* pMsgQ, UINT64 deadline )
+{
+	OSMessageRing *pRing = &pMsgQ->ring;
+	MSG_SLOT* pSlot;
+	UINT64 start = 0;
+
+	while ((pSlot = mqRingPeek(pMsgQ)) == NULL)
+	{
+		if (deadline == DEADLINE_NO_WAIT) break;
+		if (start == 0)
+		{
+			start = OSA_nowNs();
+			__atomic_add_fetch(&pMsgQ->stats.blockedReceives, 1, __ATOMIC_RELAXED);
+		}
+		if (mqRingPend(pRing, &pRing->rdEvent, &pRing->rdWaiters, 
+		               (pMsgQ->type == MQ_TYPE_MPMC) ? mqMpmcReadable : mqSpscReadable,
+		               deadline) != OK)
+			break;
+	}
+
+	if (start != 0)
+		__atomic_add_fetch(&pMsgQ->stats.receiveBlockedNs, OSA_nowNs() - start, __ATOMIC_RELAXED);
+
+	return pSlot;
+}
+
+/*
+// mqFdPost - make the notification descriptor of a message queue readable
+//
+// This routine is called after messages were queued, the eventfd is 
+// written only when it is not readable yet, so that a busy queue costs
+// no syscall.  Nothing is done until mqGetFd() was called.
+//
+// RETURNS: N/A.
+*/
+LOCAL void
+mqFdPost( OSMessageQueue* pMsgQ )
+{
+	UINT64 one = 1;
+	int fd = __atomic_load_n(&pMsgQ->efd, __ATOMIC_ACQUIRE);
+
+	if (fd < 0) return;
+
+	/* pairs with the fence of mqFdDrain(), message before flag */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pMsgQ->fdReadable, __ATOMIC_RELAXED) ||
+	    __atomic_exchange_n(&pMsgQ->fdReadable, 1, __ATOMIC_SEQ_CST))
+		return;
+
+	if (write(fd, &one, sizeof(one)) < 0) 
+		__atomic_store_n(&pMsgQ->fdReadable, 0, __ATOMIC_RELAXED);
+}
+
+/*
+// mqFdDrain - clear the notification descriptor of an empty message queue
+//
+// The eventfd is drained once the queue looks empty, then the queue is 
+// checked again, so that a message queued meanwhile makes it readable 
+// again.  It is also called when a receive finds the queue empty, as the
+// write of a sender may land after a receiver drained the eventfd.
+//
+// RETURNS: N/A.
+*/
+LOCAL void
+mqFdDrain( OSMessageQueue* pMsgQ )
+{
+	UINT64 value;
+	int fd = __atomic_load_n(&pMsgQ->efd, __ATOMIC_ACQUIRE);
+
+	if ((fd < 0) || (mqCount( (HANDLE)pMsgQ ) > 0))
+		return;
+
+	/* EAGAIN if a concurrent receiver drained it first */
+	if (read(fd, &value, sizeof(value)) < 0) value = 0;
+	__atomic_store_n(&pMsgQ->fdReadable, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (mqCount( (HANDLE)pMsgQ ) > 0)
+		mqFdPost( pMsgQ );
+}
+
+/*
+// mqFdTake - clear the notification descriptor of a drained message queue
+//
+// This routine is called after messages were received, it drains the 
+// eventfd only if it was made readable.
+//
+// RETURNS: N/A.
+*/
+LOCAL void
+mqFdTake( OSMessageQueue* pMsgQ )
+{
+	if (!__atomic_load_n(&pMsgQ->fdReadable, __ATOMIC_RELAXED))
+		return;
+
+	mqFdDrain( pMsgQ );
+}
+
+/*
+// mqRingSend - send a message to a lock-free message queue
+//
+// Lock-free queues have no priority lanes, messages are always appended.
+//
+// RETURNS: number of bytes sent, or ERROR if failed.
+*/
+LOCAL int
+mqRingSend( OSMessageQueue* pMsgQ, char *buffer, int nbytes, UINT64 deadline )
+{
+	MSG_SLOT* pSlot = mqRingPendWrite( pMsgQ, deadline );
+
+	if (pSlot == NULL) return ERROR;
+
+	bcopyBytes( buffer, MSG_SLOT_DATA(pSlot), nbytes );
+	pSlot->msgLen = nbytes;
+	mqRingCommit(pMsgQ, pSlot);
+	mqRingNotify(&pMsgQ->ring.rdEvent, &pMsgQ->ring.rdWaiters, 1);
+	mqFdPost( pMsgQ );
+
+	return nbytes;
+}
+
+/*
+// mqRingReceive - receive a message from a lock-free message queue
+//
+// RETURNS: number of bytes received, or ERROR if failed.
+*/
+LOCAL int
+mqRingReceive( OSMessageQueue* pMsgQ, char *buffer, int maxnbytes, UINT64 deadline )
+{
+	MSG_SLOT* pSlot = mqRingPendRead( pMsgQ, deadline );
+	int nret;
+
+	if (pSlot == NULL)
+	{
+		mqFdDrain( pMsgQ );
+		return ERROR;
+	}
+
+	nret = MIN(maxnbytes, pSlot->msgLen);
+	bcopyBytes( MSG_SLOT_DATA(pSlot), buffer, nret );
+	mqRingRelease(pMsgQ, pSlot);
+	mqRingNotify(&pMsgQ->ring.wrEvent, &pMsgQ->ring.wrWaiters, 1);
+	mqFdTake( pMsgQ );
+
+	return nret;
+}
+	
+/*
+// mqInit - initialize a message queue
+//
+// This routine initializes a message queue data structure.  The resulting
+// message queue draws its messages from <nclasses> size classes, class i
+// holds up to classes[i].maxMsgs messages, each of up to classes[i].maxMsgLen
+// bytes long.  Classes are sorted by message length, so that a message 
+// takes the smallest class that fits it.  Like mqCreate() a queue of one
+// class holds up to <maxMsgs> messages of up to <maxMsgLen> bytes.
+//
+// RETURNS: OK if success, otherwize ERROR.
+*/
+LOCAL STATUS
+mqInit( HANDLE handle, const MQ_SIZE_CLASS *classes, int nclasses )
+{
+    char* pool    = NULL;
+	OSMessageQueue* pMsgQ = (OSMessageQueue*)handle;
+	MQ_SIZE_CLASS sorted[MQ_SIZE_CLASSES];
+    int	size      = 0;
+    int nodeSize  = 0;
+	int ix, jx;
+	int status    = OK;
+	
+	if ((classes == NULL) || (nclasses <= 0) || (nclasses > MQ_SIZE_CLASSES))
+		return ERROR;
+
+	/* sort size classes by message length */
+	for (ix = 0; ix < nclasses; ix++)
+	{
+		if ((classes[ix].maxMsgs <= 0) || (classes[ix].maxMsgLen < 0)) 
+			return ERROR;
+		for (jx = ix; (jx > 0) && (sorted[jx-1].maxMsgLen > classes[ix].maxMsgLen); jx--)
+			sorted[jx] = sorted[jx-1];
+		sorted[jx] = classes[ix];
+		size += sorted[jx].maxMsgs * MSG_NODE_SIZE(sorted[jx].maxMsgLen);
+	}
+
+	/* clear out msg q structure */
+	bfillBytes( (char*) pMsgQ, sizeof (*pMsgQ), 0 );
+
+	status |= pthread_mutex_init(&pMsgQ->lock,  NULL);
+	status |= OSA_condInit(&pMsgQ->condrd, PTHREAD_PROCESS_PRIVATE);
+	status |= OSA_condInit(&pMsgQ->condwr, PTHREAD_PROCESS_PRIVATE); 
+	if (status) return ERROR;
+
+	pool = (char*)MEMNEW(size);
+	if(pool == NULL) return ERROR;
+
+    /* initialize internal message queues */
+	for (ix = 0; ix < MSG_PRI_LANES; ix++)
+		sllInit( &pMsgQ->qReady[ix] );
+	
+	pMsgQ->msgPool = pool;
+
+    /* put msg nodes of every class on its free list */
+	for (ix = 0; ix < nclasses; ix++)
+	{
+		sllInit( &pMsgQ->qFree[ix] );
+		nodeSize = MSG_NODE_SIZE(sorted[ix].maxMsgLen);
+		for (jx = 0; jx < sorted[ix].maxMsgs; jx++) 
+		{
+			((MSG_NODE*)pool)->msgClass = ix;
+			sllPutAtTail( &pMsgQ->qFree[ix], (SL_NODE*)pool );
+			pool += nodeSize;
+		}
+		pMsgQ->classLen[ix] = sorted[ix].maxMsgLen;
+		pMsgQ->maxMsgs     += sorted[ix].maxMsgs;
+	}
+
+    /* initialize rest of msg q */
+	pMsgQ->nClasses  = nclasses;
+	pMsgQ->maxMsgLen = sorted[nclasses - 1].maxMsgLen;
+
+	return OK;
+}
+
+/*
+// mqCleanup - cleanup message queue
+//
+// This routine cleanups a static message queue that was initialized with
+// mqInit().
+//
+// RETURNS: N/A.
+*/
+LOCAL void
+mqCleanup( HANDLE handle )
+{
+	OSMessageQueue* pMsgQ = (OSMessageQueue*)handle;
+	int lane;
+
+	if (pMsgQ->efd >= 0)
+		close(pMsgQ->efd);
+
+	if (pMsgQ->type == MQ_TYPE_SHARED)
+	{
+		munmap(pMsgQ->shm, pMsgQ->shm->size);
+		return;
+	}
+	if (pMsgQ->type != MQ_TYPE_DEFAULT)
+	{
+		MEMDEL(pMsgQ->ring.slotPool);
+		return;
+	}
+
+	/* loaned nodes are never back to lists, they are released with pool */
+	for (lane = 0; lane < pMsgQ->nClasses; lane++)
+		sllCleanup(&pMsgQ->qFree[lane]);
+	for (lane = 0; lane < MSG_PRI_LANES; lane++)
+		sllCleanup(&pMsgQ->qReady[lane]);
+
+	if(pMsgQ->msgPool != NULL)
+		MEMDEL(pMsgQ->msgPool);
+
+	pthread_cond_destroy(&pMsgQ->condrd);
+	pthread_cond_destroy(&pMsgQ->condwr);
+	pthread_mutex_destroy(&pMsgQ->lock); 
+}
+
+/*
+// mqCreate - create and initialize a message queue
+//
+// This routine creates a message queue capable of holding up to <maxMsgs>
+// messages, each up to <maxMsgLen> bytes long.  The routine returns 
+// a message queue ID used to identify the created message queue in all 
+// subsequent calls to routines in this library. 
+//
+// RETURNS: Handle to message queue, or NULL if error.
+*/
+HANDLE
+mqCreate( int maxMsgs, int maxMsgLen )
+{
+	return mqCreateEx( maxMsgs, maxMsgLen, MQ_TYPE_DEFAULT );
+}
+
+/*
+// mqCreateEx - create and initialize a message queue of specific type
+//
+// MQ_TYPE_SPSC queues are lock-free rings, which are accessed by only one
+// sender and one receiver, tasks pend only while the ring is full or empty.
+// MQ_TYPE_MPMC queues are lock-free rings shared by any number of senders
+// and receivers, every slot carries a sequence number to hand it over.
+//
+// RETURNS: Handle to message queue, or NULL if error.
+*/
+HANDLE
+mqCreateEx( int maxMsgs, int maxMsgLen, int type )
+{
+	OSMessageQueue* pMsgQ = (OSMessageQueue*)MEMNEW(sizeof(OSMessageQueue));
+	MQ_SIZE_CLASS sizeClass;
+	int status = ERROR;
+	
+    if (pMsgQ == NULL) return (NULL);
+    
+	switch (type)
+	{
+	case MQ_TYPE_DEFAULT:
+		sizeClass.maxMsgs   = maxMsgs;
+		sizeClass.maxMsgLen = maxMsgLen;
+		status = mqInit( (HANDLE)pMsgQ, &sizeClass, 1 );
+		break;
+	case MQ_TYPE_SPSC:
+	case MQ_TYPE_MPMC:
+		bfillBytes( (char*) pMsgQ, sizeof (*pMsgQ), 0 );
+		status = mqRingInit( pMsgQ, maxMsgs, maxMsgLen );
+		break;
+	default:
+		break;
+	}
+
+	if (status != OK) 
+	{
+		MEMDEL( pMsgQ );
+		return (NULL);
+	}
+
+	pMsgQ->type = type;
+	pMsgQ->efd  = -1;
+
+    return (HANDLE)pMsgQ;
+}
+
+/*
+// mqCreateVar - create a message queue of variable length messages
+//
+// This routine creates a message queue drawing its messages from several
+// pools of different message length, so that the memory reserved follows
+// the mix of short and long messages, instead of reserving the longest 
+// message for every slot.  All pools are allocated here, sending never
+// allocates memory.
+//
+// RETURNS: Handle to message queue, or NULL if error.
+*/
+HANDLE
+mqCreateVar( const MQ_SIZE_CLASS *classes, int nclasses )
+{
+	OSMessageQueue* pMsgQ = (OSMessageQueue*)MEMNEW(sizeof(OSMessageQueue));
+
+    if (pMsgQ == NULL) return (NULL);
+
+	if (mqInit( (HANDLE)pMsgQ, classes, nclasses ) != OK)
+	{
+		MEMDEL( pMsgQ );
+		return (NULL);
+	}
+
+	pMsgQ->type = MQ_TYPE_DEFAULT;
+	pMsgQ->efd  = -1;
+
+    return (HANDLE)pMsgQ;
+}
+
+/*
+// mqDelete - delete a message queue
+//
+// This routine deletes a message queue.
+//
+// RETURNS: N/A.
+*/
+void
+mqDelete( HANDLE handle )
+{
+	if (handle==NULL) return;
+	
+	mqCleanup( handle );
+	MEMDEL((char*)handle);
+	handle = NULL;
+}
+
+/*
+// mqNodeGetFree - get a free message node for a message of <nbytes>
+//
+// The smallest size class that fits the message is tried first, larger
+// classes are used when it is exhausted.  The caller must hold the lock
+// of message queue.
+//
+// RETURNS: message node, or NULL if there is no free node.
+*/
+LOCAL MSG_NODE*
+mqNodeGetFree( OSMessageQueue* pMsgQ, int nbytes )
+{
+	SL_NODE* pNode = NULL;
+	int ix;
+
+	for (ix = 0; (pNode == NULL) && (ix < pMsgQ->nClasses); ix++)
+	{
+		if (pMsgQ->classLen[ix] >= nbytes)
+			pNode = sllGet( &pMsgQ->qFree[ix] );
+	}
+
+	return (MSG_NODE*)pNode;
+}
+
+/*
+// mqNodeGetReady - get the next message node to be received
+//
+// Every priority owns a FIFO lane, the bit of a lane in readyMap is set 
+// while the lane is not empty, the highest bit set is the next lane.
+// The caller must hold the lock of message queue.
+//
+// RETURNS: message node, or NULL if there is no message.
+*/
+LOCAL MSG_NODE*
+mqNodeGetReady( OSMessageQueue* pMsgQ )
+{
+    MSG_NODE* p_msg;
+	int lane;
+
+	if (pMsgQ->readyMap == 0) return NULL;
+
+	lane  = 31 - __builtin_clz(pMsgQ->readyMap);
+	p_msg = (MSG_NODE*)sllGet( &pMsgQ->qReady[lane] );
+	if (SLL_EMPTY(&pMsgQ->qReady[lane]))
+		pMsgQ->readyMap &= ~(1U << lane);
+
+	MQ_STAT_ADD(pMsgQ, received, 1);
+	MQ_STAT_ADD(pMsgQ, depth, -1);
+
+	return p_msg;
+}
+
+/*
+// mqNodePend - get a message node of message queue
+//
+// This routine pends on <pCond> until the absolute <deadline>, while no
+// free node for a message of <nbytes> is found if <pCond> is the send 
+// condition, or no ready node otherwise.  The caller must hold the lock 
+// of message queue.
+//
+// RETURNS: message node removed from the list, or NULL if failed.
+*/
+LOCAL MSG_NODE*
+mqNodePend( OSMessageQueue* pMsgQ, int nbytes, pthread_cond_t *pCond, 
+            UINT64 deadline )
+{
+    MSG_NODE* p_msg;
+	BOOL sending = (pCond == &pMsgQ->condwr);
+	int *pWaiters = sending ? &pMsgQ->wrWaiters : &pMsgQ->rdWaiters;
+	UINT64 start = 0;
+	int status = OK;
+
+	while ((p_msg = sending ? mqNodeGetFree( pMsgQ, nbytes ) : 
+	                          mqNodeGetReady( pMsgQ )) == NULL) 
+    {
+		/* Non-blocking wait, fail if message queue is empty or full. */
+		if (deadline == DEADLINE_NO_WAIT) break;
+
+		if (start == 0)
+		{
+			start = OSA_nowNs();
+			if (sending)
+				MQ_STAT_ADD(pMsgQ, blockedSends, 1);
+			else
+				MQ_STAT_ADD(pMsgQ, blockedReceives, 1);
+		}
+
+		(*pWaiters)++;
+		status = OSA_condWaitUntil(pCond, &pMsgQ->lock, deadline);
+		(*pWaiters)--;
+
+		/* Any errors occur, return with errno. */
+	    if (status) break;
+	}
+
+	if (start != 0)
+	{
+		if (sending)
+			MQ_STAT_ADD(pMsgQ, sendBlockedNs, OSA_nowNs() - start);
+		else
+			MQ_STAT_ADD(pMsgQ, receiveBlockedNs, OSA_nowNs() - start);
+	}
+
+	return p_msg;
+}
+
+/*
+// mqNodeReady - queue a filled message node to the lane of its priority
+//
+// The caller must hold the lock of message queue, and signal readers.
+//
+// RETURNS: N/A.
+*/
+LOCAL void
+mqNodeReady( OSMessageQueue* pMsgQ, MSG_NODE* p_msg, int nbytes, int priority )
+{
+	if (priority < MSG_PRI_NORMAL) priority = MSG_PRI_NORMAL;
+	if (priority >= MSG_PRI_LANES) priority = MSG_PRI_LANES - 1;
+
+	sllPutAtTail( &pMsgQ->qReady[priority], (SL_NODE*)p_msg );
+	pMsgQ->readyMap |= (1U << priority);
+		
+	p_msg->msgLen = nbytes;
+
+	MQ_STAT_ADD(pMsgQ, sent, 1);
+	MQ_STAT_ADD(pMsgQ, depth, 1);
+	if (pMsgQ->stats.depth > pMsgQ->stats.highWater)
+		__atomic_store_n(&pMsgQ->stats.highWater, pMsgQ->stats.depth, __ATOMIC_RELAXED);
+}
+
+/*
+// mqNodeFree - give a drained message node back to the free list
+//
+// The caller must hold the lock of message queue, and signal writers.
+//
+// RETURNS: N/A.
+*/
+LOCAL void
+mqNodeFree( OSMessageQueue* pMsgQ, MSG_NODE* p_msg )
+{
+	sllPutAtTail( &pMsgQ->qFree[p_msg->msgClass], (SL_NODE*)p_msg );
+}
+
+/*
+// mqNodeSignal - wake up tasks pending on a condition of message queue
+//
+// Nothing is signalled while no task pends, one task is enough for a
+// single node, <count> nodes wake up all of them.
+//
+// RETURNS: 0 if success, or error number.
+*/
+LOCAL int
+mqNodeSignal( pthread_cond_t *pCond, int waiters, int count )
+{
+	if (waiters == 0) return 0;
+
+	return (count > 1) ? pthread_cond_broadcast(pCond) : pthread_cond_signal(pCond);
+}
+
+/*
+// mqNodeSignalFree - wake up writers after <count> nodes were freed
+//
+// Writers of a queue with several size classes may pend on different
+// classes, a freed node is offered to all of them.
+//
+// RETURNS: 0 if success, or error number.
+*/
+LOCAL int
+mqNodeSignalFree( OSMessageQueue* pMsgQ, int count )
+{
+	return mqNodeSignal( &pMsgQ->condwr, pMsgQ->wrWaiters, 
+	                     (pMsgQ->nClasses > 1) ? pMsgQ->maxMsgs : count );
+}
+
+/* message node typedefs of shared message queue */
+typedef struct SHM_NODE
+{
+	UINT32     next; /* offset of next node, 0 at end of list */
+	INT32    msgLen; /* number of bytes of data, -1 while free */
+}
+SHM_NODE;
+
+#define SHM_NODE_AT(pShm, off) ((SHM_NODE*)(((char*)pShm) + (off)))
+#define SHM_NODE_DATA(pNode)   (((char*)pNode) + sizeof(SHM_NODE))
+
+#define SHM_NODE_SIZE(msgLen) \
+	(ROUND_UP((sizeof (SHM_NODE) + msgLen), sizeof(UINT64)))
+
+#define MQ_SHM_MAGIC      0x4d51534d /* "MQSM" */
+#define MQ_SHM_OPEN_TRIES 100        /* 10ms each, waiting for the creator */
+
+/*
+// mqShmPut - append the node at <off> to an offset list
+//
+// RETURNS: N/A.
+*/
+LOCAL void
+mqShmPut( OSShmQueue* pShm, OSShmList* pList, UINT32 off )
+{
+	SHM_NODE_AT(pShm, off)->next = 0;
+	if (pList->tail != 0)
+		SHM_NODE_AT(pShm, pList->tail)->next = off;
+	else
+		pList->head = off;
+	pList->tail = off;
+}
+
+/*
+// mqShmGet - remove the first node of an offset list
+//
+// RETURNS: offset of the node, or 0 if the list is empty.
+*/
+LOCAL UINT32
+mqShmGet( OSShmQueue* pShm, OSShmList* pList )
+{
+	UINT32 off = pList->head;
+
+	if (off != 0)
+	{
+		pList->head = SHM_NODE_AT(pShm, off)->next;
+		if (pList->head == 0) pList->tail = 0;
+	}
+
+	return off;
+}
+
+/*
+// mqShmReset - put all nodes of a shared message queue on the free list
+//
+// This routine initializes the lists of a new queue, and recovers a queue
+// whose lock holder died, the lists may be broken then, so that queued 
+// messages are dropped.  The caller must hold the lock.
+//
+// RETURNS: N/A.
+*/
+LOCAL void
+mqShmReset( OSShmQueue* pShm )
+{
+	UINT32 off = pShm->nodeBase;
+	int ix;
+
+	for (ix = 0; ix < MSG_PRI_LANES; ix++)
+		pShm->qReady[ix].head = pShm->qReady[ix].tail = 0;
+	pShm->qFree.head = pShm->qFree.tail = 0;
+	pShm->readyMap   = 0;
+
+	for (ix = 0; ix < pShm->maxMsgs; ix++, off += pShm->nodeSize) 
+	{
+		SHM_NODE_AT(pShm, off)->msgLen = -1;
+		mqShmPut( pShm, &pShm->qFree, off );
+	}
+
+	__atomic_store_n(&pShm->stats.depth, 0, __ATOMIC_RELAXED);
+}
+
+/*
+// mqShmLock - lock a shared message queue
+//
+// The mutex is robust, if its holder died the queue is reset and the
+// mutex made consistent.
+//
+// RETURNS: 0 if success, or error number.
+*/
+LOCAL int
+mqShmLock( OSShmQueue* pShm )
+{
+	int status = pthread_mutex_lock(&pShm->lock);
+
+	if (status == EOWNERDEAD)
+	{
+		mqShmReset( pShm );
+		status = pthread_mutex_consistent(&pShm->lock);
+	}
+
+	return status;
+}
+
+/*
+// mqShmInit - initialize a shared message queue just mapped by its creator
+//
+// RETURNS: OK if success, otherwize ERROR.
+*/
+LOCAL STATUS
+mqShmInit( OSShmQueue* pShm, UINT32 size, int maxMsgs, int maxMsgLen )
+{
+	pthread_mutexattr_t mattr;
+	int status = OK;
+
+	pShm->size      = size;
+	pShm->maxMsgs   = maxMsgs;
+	pShm->maxMsgLen = maxMsgLen;
+	pShm->nodeSize  = SHM_NODE_SIZE(maxMsgLen);
+	pShm->nodeBase  = SHM_NODE_SIZE(sizeof(OSShmQueue));
+
+	status |= pthread_mutexattr_init(&mattr);
+	status |= pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+	status |= pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+	status |= pthread_mutex_init(&pShm->lock, &mattr);
+	pthread_mutexattr_destroy(&mattr);
+
+	status |= OSA_condInit(&pShm->condrd, PTHREAD_PROCESS_SHARED);
+	status |= OSA_condInit(&pShm->condwr, PTHREAD_PROCESS_SHARED);
+	if (status) return ERROR;
+
+	mqShmReset( pShm );
+
+	/* publish the queue to processes waiting in mqOpenShared() */
+	__atomic_store_n(&pShm->magic, MQ_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	return OK;
+}
+
+/*
+// mqShmAttach - map a shared message queue created by another process
+//
+// The creator may still be initializing the queue, the region is mapped
+// once it has its size, and used once the magic is published.
+//
+// RETURNS: mapped queue, or NULL if failed.
+*/
+LOCAL OSShmQueue*
+mqShmAttach( int fd, int maxMsgLen )
+{
+	OSShmQueue* pShm = MAP_FAILED;
+	struct stat st;
+	int tries;
+
+	for (tries = 0; tries < MQ_SHM_OPEN_TRIES; tries++)
+	{
+		if (pShm == MAP_FAILED)
+		{
+			if (fstat(fd, &st) != 0) return NULL;
+			if (st.st_size >= (off_t)sizeof(OSShmQueue))
+				pShm = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		}
+		if ((pShm != MAP_FAILED) && 
+		    (__atomic_load_n(&pShm->magic, __ATOMIC_ACQUIRE) == MQ_SHM_MAGIC))
+		{
+			if ((pShm->size == (UINT32)st.st_size) && (pShm->maxMsgLen >= maxMsgLen))
+				return pShm;
+			break;
+		}
+		usleep(10000);
+	}
+
+	if (pShm != MAP_FAILED) munmap(pShm, st.st_size);
+
+	return NULL;
+}
+
+/*
+// mqShmPend - get a message node of shared message queue
+//
+// This routine pends on <pCond> while <get> finds no node, the caller 
+// must hold the lock of message queue.
+//
+// RETURNS: offset of message node removed from the list, or 0 if failed.
+*/
+LOCAL UINT32
+mqShmPend( OSShmQueue* pShm, UINT32(*get)(OSShmQueue*), pthread_cond_t *pCond, UINT64 deadline )
+{
+	BOOL sending = (pCond == &pShm->condwr);
+	int *pWaiters = sending ? &pShm->wrWaiters : &pShm->rdWaiters;
+	UINT64 start = 0;
+	UINT32 off;
+	int status = OK;
+
+	while ((off = (*get)( pShm )) == 0) 
+	{
+		if (deadline == DEADLINE_NO_WAIT) break;
+
+		if (start == 0)
+		{
+			start = OSA_nowNs();
+			if (sending)
+				MQ_STAT_ADD(pShm, blockedSends, 1);
+			else
+				MQ_STAT_ADD(pShm, blockedReceives, 1);
+		}
+
+		(*pWaiters)++;
+		status = OSA_condWaitUntil(pCond, &pShm->lock, deadline);
+		(*pWaiters)--;
+
+		/* lock holder died while we were pending */
+		if (status == EOWNERDEAD)
+		{
+			mqShmReset( pShm );
+			status = pthread_mutex_consistent(&pShm->lock);
+		}
+	    if (status) break;
+	}
+
+	if (start != 0)
+	{
+		if (sending)
+			MQ_STAT_ADD(pShm, sendBlockedNs, OSA_nowNs() - start);
+		else
+			MQ_STAT_ADD(pShm, receiveBlockedNs, OSA_nowNs() - start);
+	}
+
+	return off;
+}
+
+/*
+// mqShmGetFree - get a free node of shared message queue
+//
+// RETURNS: offset of message node, or 0 if the queue is full.
+*/
+LOCAL UINT32
+mqShmGetFree( OSShmQueue* pShm )
+{
+	return mqShmGet( pShm, &pShm->qFree );
+}
+
+/*
+// mqShmGetReady - get the next message node of shared message queue
+//
+// RETURNS: offset of message node, or 0 if the queue is empty.
+*/
+LOCAL UINT32
+mqShmGetReady( OSShmQueue* pShm )
+{
+	UINT32 off;
+	int lane;
+
+	if (pShm->readyMap == 0) return 0;
+
+	lane = 31 - __builtin_clz(pShm->readyMap);
+	off  = mqShmGet( pShm, &pShm->qReady[lane] );
+	if (pShm->qReady[lane].head == 0)
+		pShm->readyMap &= ~(1U << lane);
+
+	MQ_STAT_ADD(pShm, received, 1);
+	MQ_STAT_ADD(pShm, depth, -1);
+
+	return off;
+}
+
+/*
+// mqShmSend - send a batch of messages to a shared message queue
+//
+// RETURNS: number of messages sent, or ERROR if none was sent.
+*/
+LOCAL int
+mqShmSend( OSMessageQueue* pMsgQ, MQ_VEC *vec, int count, UINT64 deadline, int priority )
+{
+	OSShmQueue* pShm = pMsgQ->shm;
+	SHM_NODE* pNode;
+	UINT32 off;
+	int nsent = 0, status = OK;
+
+	if (priority < MSG_PRI_NORMAL) priority = MSG_PRI_NORMAL;
+	if (priority >= MSG_PRI_LANES) priority = MSG_PRI_LANES - 1;
+
+	if (mqShmLock( pShm )) return ERROR;
+
+	off = mqShmPend( pShm, mqShmGetFree, &pShm->condwr, deadline );
+	while (off != 0)
+	{
+		pNode = SHM_NODE_AT(pShm, off);
+		bcopyBytes( vec[nsent].buffer, SHM_NODE_DATA(pNode), vec[nsent].nbytes );
+		pNode->msgLen = vec[nsent].nbytes;
+		mqShmPut( pShm, &pShm->qReady[priority], off );
+		pShm->readyMap |= (1U << priority);
+
+		MQ_STAT_ADD(pShm, sent, 1);
+		MQ_STAT_ADD(pShm, depth, 1);
+		if (pShm->stats.depth > pShm->stats.highWater)
+			__atomic_store_n(&pShm->stats.highWater, pShm->stats.depth, __ATOMIC_RELAXED);
+
+		off = (++nsent < count) ? mqShmGetFree( pShm ) : 0;
+	}
+	if (nsent > 0)
+		status = mqNodeSignal( &pShm->condrd, pShm->rdWaiters, nsent );
+	pthread_mutex_unlock(&pShm->lock);
+
+	return ((nsent == 0) || status) ? ERROR : nsent;
+}
+
+/*
+// mqShmReceive - receive a batch of messages from a shared message queue
+//
+// RETURNS: number of messages received, or ERROR if none was received.
+*/
+LOCAL int
+mqShmReceive( OSMessageQueue* pMsgQ, MQ_VEC *vec, int count, UINT64 deadline )
+{
+	OSShmQueue* pShm = pMsgQ->shm;
+	SHM_NODE* pNode;
+	UINT32 off;
+	int nrecv = 0, status = OK;
+
+	if (mqShmLock( pShm )) return ERROR;
+
+	off = mqShmPend( pShm, mqShmGetReady, &pShm->condrd, deadline );
+	while (off != 0)
+	{
+		pNode = SHM_NODE_AT(pShm, off);
+		vec[nrecv].nbytes = MIN(vec[nrecv].nbytes, pNode->msgLen);
+		bcopyBytes( SHM_NODE_DATA(pNode), vec[nrecv].buffer, vec[nrecv].nbytes );
+		pNode->msgLen = -1;
+		mqShmPut( pShm, &pShm->qFree, off );
+
+		off = (++nrecv < count) ? mqShmGetReady( pShm ) : 0;
+	}
+	if (nrecv > 0)
+		status = mqNodeSignal( &pShm->condwr, pShm->wrWaiters, nrecv );
+	pthread_mutex_unlock(&pShm->lock);
+
+	return ((nrecv == 0) || status) ? ERROR : nrecv;
+}
+
+/*
+// mqOpenShared - open a named message queue shared by processes
+//
+// This routine maps the message queue <name> in POSIX shared memory, the 
+// queue is created for <maxMsgs> messages of up to <maxMsgLen> bytes if it
+// does not exist.  Lists hold offsets instead of pointers, so that every 
+// process may map the queue at a different address, and a message crosses
+// processes with one copy in and one copy out.  mqDelete() unmaps the 
+// queue, mqUnlinkShared() removes its name.
+//
+// RETURNS: Handle to message queue, or NULL if error.
+*/
+HANDLE
+mqOpenShared( const char *name, int maxMsgs, int maxMsgLen )
+{
+	OSMessageQueue* pMsgQ;
+	OSShmQueue* pShm = NULL;
+	UINT64 size;
+	int fd;
+
+	if ((name == NULL) || (maxMsgLen < 0)) return (NULL);
+
+	pMsgQ = (OSMessageQueue*)MEMNEW(sizeof(OSMessageQueue));
+    if (pMsgQ == NULL) return (NULL);
+	bfillBytes( (char*) pMsgQ, sizeof (*pMsgQ), 0 );
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0660);
+	if (fd >= 0)
+	{
+		size = SHM_NODE_SIZE(sizeof(OSShmQueue)) + (UINT64)maxMsgs * SHM_NODE_SIZE(maxMsgLen);
+		if ((maxMsgs > 0) && (size <= 0xffffffffULL) && (ftruncate(fd, size) == 0))
+		{
+			pShm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (pShm == MAP_FAILED) 
+				pShm = NULL;
+			else if (mqShmInit( pShm, (UINT32)size, maxMsgs, maxMsgLen ) != OK)
+			{
+				munmap(pShm, size);
+				pShm = NULL;
+			}
+		}
+		if (pShm == NULL) shm_unlink(name);
+	}
+	else if (errno == EEXIST)
+	{
+		fd = shm_open(name, O_RDWR, 0);
+		if (fd >= 0) pShm = mqShmAttach( fd, maxMsgLen );
+	}
+
+	if (fd >= 0) close(fd);
+
+	if (pShm == NULL)
+	{
+		MEMDEL( pMsgQ );
+		return (NULL);
+	}
+
+	pMsgQ->type      = MQ_TYPE_SHARED;
+	pMsgQ->efd       = -1;
+	pMsgQ->shm       = pShm;
+	pMsgQ->maxMsgs   = pShm->maxMsgs;
+	pMsgQ->maxMsgLen = pShm->maxMsgLen;
+
+    return (HANDLE)pMsgQ;
+}
+
+/*
+// mqUnlinkShared - remove the name of a shared message queue
+//
+// Processes having the queue opened may still use it, the shared memory
+// is released after all of them deleted their handles.
+//
+// RETURNS: OK if success, or ERROR.
+*/
+STATUS
+mqUnlinkShared( const char *name )
+{
+	if (name == NULL) return ERROR;
+
+	return (shm_unlink(name) == 0) ? OK : ERROR;
+}
+
+/*
+// mqSend - send a message to a message queue
+//
+// This routine sends the message in <buffer> of length <nBytes> to the message
+// queue <pMsgQ>.  
+//
+// RETURNS: number of bytes received, or ERROR if failed.
+*/
+int 
+mqSend( HANDLE handle, char *buffer, int nbytes, int tminms, int priority )
+{
+	return mqSendUntil( handle, buffer, nbytes, OSA_deadline(tminms), priority );
+}
+
+/*
+// mqSendUntil - send a message to a message queue before a deadline
+//
+// This routine sends the message in <buffer> of length <nBytes> to the message
+// queue <pMsgQ>, pending until the absolute <deadline> if it is full.
+//
+// RETURNS: number of bytes sent, or ERROR if failed.
+*/
+int 
+mqSendUntil( HANDLE handle, char *buffer, int nbytes, UINT64 deadline, int priority )
+{
+    MSG_NODE* p_msg;
+	OSMessageQueue* pMsgQ = (OSMessageQueue*)handle;
+	int status = OK;
+
+	if((pMsgQ == NULL) || (nbytes > pMsgQ->maxMsgLen))
+		return ERROR;
+
+	if (pMsgQ->type == MQ_TYPE_SHARED)
+	{
+		MQ_VEC vec;
+
+		vec.buffer = buffer;
+		vec.nbytes = nbytes;
+		return (mqShmSend( pMsgQ, &vec, 1, deadline, priority ) == 1) ? nbytes : ERROR;
+	}
+	if (pMsgQ->type != MQ_TYPE_DEFAULT)
+		return mqRingSend( pMsgQ, buffer, nbytes, deadline );
+
+	pthread_mutex_lock(&pMsgQ->lock);
+	p_msg = mqNodePend( pMsgQ, nbytes, &pMsgQ->condwr, deadline );
+	if (p_msg != NULL)
+	{
+		bcopyBytes( buffer, MSG_NODE_DATA(p_msg), nbytes );
+		mqNodeReady( pMsgQ, p_msg, nbytes, priority );
+		status = mqNodeSignal( &pMsgQ->condrd, pMsgQ->rdWaiters, 1 );
+	}
+	pthread_mutex_unlock(&pMsgQ->lock);
+
+	if (p_msg != NULL) mqFdPost( pMsgQ );
+
+	return ((p_msg == NULL) || status) ? ERROR : nbytes;
+}
+
+/*
+// mqReceive - receive a message from a message queue
+//
+// This routine receives a message from the message queue <pMsgQ>.
+// The received message is copied into the specified <buffer>, which is
+// <maxNBytes> in length.  If the message is longer than <maxNBytes>,
+// the remainder of the message is discarded (no error indication
+// is returned).
+//
+// RETURNS: number of bytes received, or ERROR if failed.
+*/
+int
 mqReceive( HANDLE handle, char *buffer, int maxnbytes, int tminms )
 {
-    MSG_NODE* p_msg;
-	OSMessageQueue* pMsgQ = (OSMessageQueue*)handle;
-    int nret, status = OK;
+	return mqReceiveUntil( handle, buffer, maxnbytes, OSA_deadline(tminms) );
+}
+
+/*
+// mqReceiveUntil - receive a message from a message queue before a deadline
+//
+// Like mqReceive(), but pends until the absolute <deadline> if the queue 
+// is empty.
+//
+// RETURNS: number of bytes received, or ERROR if failed.
+*/
+int
+mqReceiveUntil( HANDLE handle, char *buffer, int maxnbytes, UINT64 deadline )
+{
+    MSG_NODE* p_msg;
+	OSMessageQueue* pMsgQ = (OSMessageQueue*)handle;
+    int nret = 0, status = OK;
+
+	if (pMsgQ==NULL) return ERROR;
+	
+	if (pMsgQ->type == MQ_TYPE_SHARED)
+	{
+		MQ_VEC vec;
+
+		vec.buffer = buffer;
+		vec.nbytes = maxnbytes;
+		return (mqShmReceive( pMsgQ, &vec, 1, deadline ) == 1) ? vec.nbytes : ERROR;
+	}
+	if (pMsgQ->type != MQ_TYPE_DEFAULT)
+		return mqRingReceive( pMsgQ, buffer, maxnbytes, deadline );
+
+	pthread_mutex_lock(&pMsgQ->lock);
+	p_msg = mqNodePend( pMsgQ, 0, &pMsgQ->condrd, deadline );
+	if (p_msg != NULL)
+	{
+		nret = MIN(maxnbytes, p_msg->msgLen);
+		bcopyBytes( MSG_NODE_DATA(p_msg), buffer, nret );
+		mqNodeFree( pMsgQ, p_msg );
+		status = mqNodeSignalFree( pMsgQ, 1 );
+	}
+	pthread_mutex_unlock(&pMsgQ->lock);
+
+	if (p_msg != NULL) 
+		mqFdTake( pMsgQ );
+	else
+		mqFdDrain( pMsgQ );
+
+	return ((p_msg == NULL) || status) ? ERROR : nret;
+}
+
+/*
+// mqSendBatch - send a batch of messages to a message queue
+//
+// This routine sends the messages described by <vec> to the message queue
+// <pMsgQ>.  It pends only for the first message, the rest are sent while
+// there are free slots, under one lock acquisition and with at most one 
+// wakeup of the receivers.
+//
+// RETURNS: number of messages sent, or ERROR if none was sent.
+*/
+int 
+mqSendBatch( HANDLE handle, MQ_VEC *vec, int count, int tminms, int priority )
+{
+    MSG_NODE* p_msg;
+	OSMessageQueue* pMsgQ = (OSMessageQueue*)handle;
+	int nsent = 0, status = OK;
+
+	if((pMsgQ == NULL) || (vec == NULL) || (count <= 0))
+		return ERROR;
+
+	for (nsent = 0; nsent < count; nsent++)
+	{
+		if (vec[nsent].nbytes > pMsgQ->maxMsgLen) return ERROR;
+	}
+	nsent = 0;
+
+	if (pMsgQ->type == MQ_TYPE_SHARED)
+		return mqShmSend( pMsgQ, vec, count, OSA_deadline(tminms), priority );
+
+	if (pMsgQ->type != MQ_TYPE_DEFAULT)
+	{
+		MSG_SLOT* pSlot = mqRingPendWrite( pMsgQ, OSA_deadline(tminms) );
+
+		while (pSlot != NULL)
+		{
+			bcopyBytes( vec[nsent].buffer, MSG_SLOT_DATA(pSlot), vec[nsent].nbytes );
+			pSlot->msgLen = vec[nsent].nbytes;
+			mqRingCommit(pMsgQ, pSlot);
+			pSlot = (++nsent < count) ? mqRingReserve(pMsgQ) : NULL;
+		}
+		if (nsent > 0)
+		{
+			mqRingNotify(&pMsgQ->ring.rdEvent, &pMsgQ->ring.rdWaiters, nsent);
+			mqFdPost( pMsgQ );
+		}
+		return (nsent > 0) ? nsent : ERROR;
+	}
+
+	pthread_mutex_lock(&pMsgQ->lock);
+	p_msg = mqNodePend( pMsgQ, vec[0].nbytes, &pMsgQ->condwr, OSA_deadline(tminms) );
+	while (p_msg != NULL)
+	{
+		bcopyBytes( vec[nsent].buffer, MSG_NODE_DATA(p_msg), vec[nsent].nbytes );
+		mqNodeReady( pMsgQ, p_msg, vec[nsent].nbytes, priority );
+		p_msg = (++nsent < count) ? mqNodeGetFree( pMsgQ, vec[nsent].nbytes ) : NULL;
+	}
+	if (nsent > 0)
+		status = mqNodeSignal( &pMsgQ->condrd, pMsgQ->rdWaiters, nsent );
+	pthread_mutex_unlock(&pMsgQ->lock);
+
+	if (nsent > 0) mqFdPost( pMsgQ );
+
+	return ((nsent == 0) || status) ? ERROR : nsent;
+}
+
+/*
+// mqReceiveBatch - receive a batch of messages from a message queue
+//
+// This routine receives up to <count> messages from the message queue 
+// <pMsgQ>, into the buffers described by <vec>.  On input the nbytes of 
+// each entry is the size of its buffer, on output it is the number of bytes
+// received, longer messages are truncated.  It pends only for the first
+// message, under one lock acquisition and with at most one wakeup of 
+// the senders.
+//
+// RETURNS: number of messages received, or ERROR if none was received.
+*/
+int 
+mqReceiveBatch( HANDLE handle, MQ_VEC *vec, int count, int tminms )
+{
+    MSG_NODE* p_msg;
+	OSMessageQueue* pMsgQ = (OSMessageQueue*)handle;
+	int nrecv = 0, status = OK;
+
+	if((pMsgQ == NULL) || (vec == NULL) || (count <= 0))
+		return ERROR;
+
+	if (pMsgQ->type == MQ_TYPE_SHARED)
+		return mqShmReceive( pMsgQ, vec, count, OSA_deadline(tminms) );
+
+	if (pMsgQ->type != MQ_TYPE_DEFAULT)
+	{
+		MSG_SLOT* pSlot = mqRingPendRead( pMsgQ, OSA_deadline(tminms) );
+
+		while (pSlot != NULL)
+		{
+			vec[nrecv].nbytes = MIN(vec[nrecv].nbytes, pSlot->msgLen);
+			bcopyBytes( MSG_SLOT_DATA(pSlot), vec[nrecv].buffer, vec[nrecv].nbytes );
+			mqRingRelease(pMsgQ, pSlot);
+			pSlot = (++nrecv < count) ? mqRingPeek(pMsgQ) : NULL;
+		}
+		if (nrecv > 0)
+		{
+			mqRingNotify(&pMsgQ->ring.wrEvent, &pMsgQ->ring.wrWaiters, nrecv);
+			mqFdTake( pMsgQ );
+			return nrecv;
+		}
+		mqFdDrain( pMsgQ );
+		return ERROR;
+	}
+
+	pthread_mutex_lock(&pMsgQ->lock);
+	p_msg = mqNodePend( pMsgQ, 0, &pMsgQ->condrd, OSA_deadline(tminms) );
+	while (p_msg != NULL)
+	{
+		vec[nrecv].nbytes = MIN(vec[nrecv].nbytes, p_msg->msgLen);
+		bcopyBytes( MSG_NODE_DATA(p_msg), vec[nrecv].buffer, vec[nrecv].nbytes );
+		mqNodeFree( pMsgQ, p_msg );
+		p_msg = (++nrecv < count) ? mqNodeGetReady( pMsgQ ) : NULL;
+	}
+	if (nrecv > 0)
+		status = mqNodeSignalFree( pMsgQ, nrecv );
+	pthread_mutex_unlock(&pMsgQ->lock);
+
+	if (nrecv > 0) 
+		mqFdTake( pMsgQ );
+	else
+		mqFdDrain( pMsgQ );
+
+	return ((nrecv == 0) || status) ? ERROR : nrecv;
+}
+
+/*
+// mqSendLoan - borrow a free message buffer of a message queue
+//
+// This routine takes a free message slot of the queue <pMsgQ> and returns
+// its buffer, so that the message can be built in place.  The buffer must
+// be handed back with mqSendCommit(), no data is copied.  A MQ_TYPE_SPSC
+// producer may hold only one loan, and must not call mqSend() meanwhile.
+//
+// RETURNS: message buffer of at least <nbytes>, or NULL if failed.
+*/
+char*
+mqSendLoan( HANDLE handle, int nbytes, int tminms )
+{
+    MSG_NODE* p_msg;
+	OSMessageQueue* pMsgQ = (OSMessageQueue*)handle;
+
+	if((pMsgQ == NULL) || (nbytes > pMsgQ->maxMsgLen) || (pMsgQ->type == MQ_TYPE_SHARED))
+		return NULL;
+
+	if (pMsgQ->type != MQ_TYPE_DEFAULT)
+	{
+		MSG_SLOT* pSlot = mqRingPendWrite( pMsgQ, OSA_deadline(tminms) );
+		return (pSlot == NULL) ? NULL : MSG_SLOT_DATA(pSlot);
+	}
+
+	pthread_mutex_lock(&pMsgQ->lock);
+	p_msg = mqNodePend( pMsgQ, nbytes, &pMsgQ->condwr, OSA_deadline(tminms) );
+	pthread_mutex_unlock(&pMsgQ->lock);
+
+	return (p_msg == NULL) ? NULL : MSG_NODE_DATA(p_msg);
+}
+
+/*
+// mqSendCommit - send a message built in a loaned buffer
+//
+// This routine queues the buffer returned by mqSendLoan() as a message of
+// <nbytes> bytes, the buffer belongs to the message queue again.
+//
+// RETURNS: OK if success, or ERROR if failed.
+*/
+STATUS
+mqSendCommit( HANDLE handle, char *buffer, int nbytes, int priority )
+{
+	OSMessageQueue* pMsgQ = (OSMessageQueue*)handle;
+	int status = OK;
+
+	if((pMsgQ == NULL) || (buffer == NULL) || (nbytes > pMsgQ->maxMsgLen) || 
+	   (pMsgQ->type == MQ_TYPE_SHARED))
+		return ERROR;
+
+	if (pMsgQ->type != MQ_TYPE_DEFAULT)
+	{
+		MSG_SLOT* pSlot = MSG_SLOT_OF(buffer);
+
+		pSlot->msgLen = nbytes;
+		mqRingCommit(pMsgQ, pSlot);
+		mqRingNotify(&pMsgQ->ring.rdEvent, &pMsgQ->ring.rdWaiters, 1);
+		mqFdPost( pMsgQ );
+		return OK;
+	}
+
+	if (nbytes > pMsgQ->classLen[MSG_NODE_OF(buffer)->msgClass])
+		return ERROR;
+
+	pthread_mutex_lock(&pMsgQ->lock);
+	mqNodeReady( pMsgQ, MSG_NODE_OF(buffer), nbytes, priority );
+	status = mqNodeSignal( &pMsgQ->condrd, pMsgQ->rdWaiters, 1 );
+	pthread_mutex_unlock(&pMsgQ->lock);
+
+	mqFdPost( pMsgQ );
+
+	return status ? ERROR : OK;
+}
+
+/*
+// mqReceiveLoan - borrow the buffer of the next message of a message queue
+//
+// This routine takes the next message of the queue <pMsgQ> and returns its
+// buffer in <pbuffer>, so that the message can be read in place.  The 
+// buffer must be handed back with mqReceiveRelease(), no data is copied.
+// A MQ_TYPE_SPSC consumer may hold only one loan, and must not call 
+// mqReceive() meanwhile.
+//
+// RETURNS: number of bytes of the message, or ERROR if failed.
+*/
+int
+mqReceiveLoan( HANDLE handle, char **pbuffer, int tminms )
+{
+    MSG_NODE* p_msg;
+	OSMessageQueue* pMsgQ = (OSMessageQueue*)handle;
+
+	if ((pMsgQ == NULL) || (pbuffer == NULL) || (pMsgQ->type == MQ_TYPE_SHARED)) 
+		return ERROR;
+
+	if (pMsgQ->type != MQ_TYPE_DEFAULT)
+	{
+		MSG_SLOT* pSlot = mqRingPendRead( pMsgQ, OSA_deadline(tminms) );
+
+		if (pSlot == NULL)
+		{
+			mqFdDrain( pMsgQ );
+			return ERROR;
+		}
+		mqFdTake( pMsgQ );
+		*pbuffer = MSG_SLOT_DATA(pSlot);
+		return pSlot->msgLen;
+	}
+
+	pthread_mutex_lock(&pMsgQ->lock);
+	p_msg = mqNodePend( pMsgQ, 0, &pMsgQ->condrd, OSA_deadline(tminms) );
+	pthread_mutex_unlock(&pMsgQ->lock);
+
+	if (p_msg == NULL)
+	{
+		mqFdDrain( pMsgQ );
+		return ERROR;
+	}
+
+	mqFdTake( pMsgQ );
+	*pbuffer = MSG_NODE_DATA(p_msg);
+	
+	return p_msg->msgLen;
+}
+
+/*
+// mqReceiveRelease - give a loaned message buffer back to a message queue
+//
+// RETURNS: OK if success, or ERROR if failed.
+*/
+STATUS
+mqReceiveRelease( HANDLE handle, char *buffer )
+{
+	OSMessageQueue* pMsgQ = (OSMessageQueue*)handle;
+	int status = OK;
+
+	if ((pMsgQ == NULL) || (buffer == NULL) || (pMsgQ->type == MQ_TYPE_SHARED)) 
+		return ERROR;
+
+	if (pMsgQ->type != MQ_TYPE_DEFAULT)
+	{
+		mqRingRelease(pMsgQ, MSG_SLOT_OF(buffer));
+		mqRingNotify(&pMsgQ->ring.wrEvent, &pMsgQ->ring.wrWaiters, 1);
+		/* the loaned slot was counted until now */
+		mqFdTake( pMsgQ );
+		return OK;
+	}
+
+	pthread_mutex_lock(&pMsgQ->lock);
+	mqNodeFree( pMsgQ, MSG_NODE_OF(buffer) );
+	status = mqNodeSignalFree( pMsgQ, 1 );
+	pthread_mutex_unlock(&pMsgQ->lock);
+
+	return status ? ERROR : OK;
+}
+
+/*
+// mqCount - get the number of messages queued to a message queue
+//
+// The depth is read without taking the queue lock, so that monitors 
+// never stall senders or receivers.
+//
+// RETURNS: The number of messages queued, or ERROR.
+*/
+int 
+mqCount( HANDLE handle )
+{
+	OSMessageQueue* pMsgQ = (OSMessageQueue*)handle;
+	int     count = 0;
+	
+	if (pMsgQ==NULL) return 0;
+
+	if (pMsgQ->type == MQ_TYPE_SHARED)
+		return __atomic_load_n(&pMsgQ->shm->stats.depth, __ATOMIC_RELAXED);
+
+	if (pMsgQ->type != MQ_TYPE_DEFAULT)
+	{
+		UINT64 head = __atomic_load_n(&pMsgQ->ring.head, __ATOMIC_ACQUIRE);
+		
+		/* tail may run ahead of published slots in MQ_TYPE_MPMC */
+		count = (int)(__atomic_load_n(&pMsgQ->ring.tail, __ATOMIC_ACQUIRE) - head);
+		return MIN(count, pMsgQ->maxMsgs);
+	}
+
+	return __atomic_load_n(&pMsgQ->stats.depth, __ATOMIC_RELAXED);
+}
+
+/*
+// mqGetStats - get a snapshot of statistics of a message queue
+//
+// The counters are read without taking the queue lock, they are not
+// a consistent snapshot while the queue is busy.  Lock-free queues
+// count the messages by their ring indices, their high-water mark is 
+// sampled when either side finds the ring full or catches up.
+//
+// RETURNS: OK if success, or ERROR.
+*/
+STATUS 
+mqGetStats( HANDLE handle, MQ_STATS *stats )
+{
+	OSMessageQueue* pMsgQ = (OSMessageQueue*)handle;
+	MQ_STATS* pStats;
+
+	if ((pMsgQ == NULL) || (stats == NULL)) return ERROR;
+
+	pStats = (pMsgQ->type == MQ_TYPE_SHARED) ? &pMsgQ->shm->stats : &pMsgQ->stats;
+
+	stats->blockedSends     = __atomic_load_n(&pStats->blockedSends, __ATOMIC_RELAXED);
+	stats->blockedReceives  = __atomic_load_n(&pStats->blockedReceives, __ATOMIC_RELAXED);
+	stats->sendBlockedNs    = __atomic_load_n(&pStats->sendBlockedNs, __ATOMIC_RELAXED);
+	stats->receiveBlockedNs = __atomic_load_n(&pStats->receiveBlockedNs, __ATOMIC_RELAXED);
+
+	if ((pMsgQ->type == MQ_TYPE_SPSC) || (pMsgQ->type == MQ_TYPE_MPMC))
+	{
+		stats->received  = __atomic_load_n(&pMsgQ->ring.head, __ATOMIC_ACQUIRE);
+		stats->sent      = __atomic_load_n(&pMsgQ->ring.tail, __ATOMIC_ACQUIRE);
+		stats->depth     = (int)MIN(stats->sent - stats->received, (UINT64)pMsgQ->maxMsgs);
+		stats->highWater = __atomic_load_n(&pMsgQ->ring.highWater, __ATOMIC_RELAXED);
+		stats->highWater = MAX(stats->highWater, stats->depth);
+	}
+	else
+	{
+		stats->sent      = __atomic_load_n(&pStats->sent, __ATOMIC_RELAXED);
+		stats->received  = __atomic_load_n(&pStats->received, __ATOMIC_RELAXED);
+		stats->depth     = __atomic_load_n(&pStats->depth, __ATOMIC_RELAXED);
+		stats->highWater = __atomic_load_n(&pStats->highWater, __ATOMIC_RELAXED);
+	}
+
+	return OK;
+}
+
+/*
+// mqGetFd - get the notification descriptor of a message queue
+//
+// This routine returns an eventfd which is readable while messages are 
+// queued, so that a task may wait for the queue in select() or poll() 
+// together with sockets and serial ports, and then receive with NO_WAIT.
+// The descriptor is created on first call and closed by mqDelete(), the
+// caller must not read or close it.  Queues never asked for it pay nothing.
+//
+// RETURNS: file descriptor, or ERROR.
+*/
+int
+mqGetFd( HANDLE handle )
+{
+	OSMessageQueue* pMsgQ = (OSMessageQueue*)handle;
+	int fd, unset = -1;
+
+	if ((pMsgQ == NULL) || (pMsgQ->type == MQ_TYPE_SHARED)) return ERROR;
+
+	fd = __atomic_load_n(&pMsgQ->efd, __ATOMIC_ACQUIRE);
+	if (fd >= 0) return fd;
+
+	fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd < 0) return ERROR;
+
+	/* another task may install its descriptor first */
+	if (!__atomic_compare_exchange_n(&pMsgQ->efd, &unset, fd, FALSE, 
+	                                 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		close(fd);
+		return unset;
+	}
+
+	/* messages queued before the descriptor existed */
+	if (mqCount( handle ) > 0)
+		mqFdPost( pMsgQ );
+
+	return fd;
+}
+
+/********************************************************************************
+// L I N U X  M U T E X  R O U T I N E S
+********************************************************************************/
+/*
+// Create a mutex.
+//
+// RETURNS: Handle to mutex.
+*/
+HANDLE mutexCreate( void )
+{
+	return mutexCreateEx( 0, 0 );
+}
+
+/*
+// Create a mutex with options.
+//
+// MUTEX_OPT_INHERIT raises the owner to the priority of the highest task
+// pending on the mutex, which bounds priority inversion between SCHED_FIFO
+// tasks.  MUTEX_OPT_ADAPTIVE makes a locker spin before it sleeps, for
+// <spin> rounds counted in the spin statistics, or OSA_SPIN_DEFAULT rounds
+// if <spin> is 0.  MUTEX_OPT_ADAPTIVE_NP lets glibc spin instead, without
+// statistics, it is not a recursive mutex.  MUTEX_OPT_RECURSIVE lets the
+// owner lock it again, MUTEX_OPT_ROBUST hands the mutex of a dead owner to
+// the next locker, which learns it from mutexOwnerDied().
+//
+// RETURNS: Handle to mutex, or NULL if failed.
+*/
+HANDLE mutexCreateEx( int options, int spin )
+{
+	OSMutex *pMtx = (OSMutex*)MEMNEW(sizeof(OSMutex));
+	pthread_mutexattr_t attr;
+	int status = 0;
+	
+	if (pMtx == NULL) return (NULL);
+	
+	bfillBytes( (char*) pMtx, sizeof (*pMtx), 0 );
+	pMtx->options = options;
+	pMtx->spin    = OSA_spinBudget( (options & MUTEX_OPT_ADAPTIVE) != 0, spin );
+
+	/* a glibc mutex has one type */
+	if ((options & MUTEX_OPT_RECURSIVE) && (options & MUTEX_OPT_ADAPTIVE_NP))
+	{
+		MEMDEL( pMtx );
+		return (NULL);
+	}
+
+	status |= pthread_mutexattr_init(&attr);
+	if (options & MUTEX_OPT_RECURSIVE)
+		status |= pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	else if (options & MUTEX_OPT_ADAPTIVE_NP)
+		status |= pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP);
+	if (options & MUTEX_OPT_INHERIT)
+		status |= pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	if (options & MUTEX_OPT_ROBUST)
+		status |= pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	if (status == 0)
+		status = pthread_mutex_init(&pMtx->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	if (status)
+	{
+		MEMDEL( pMtx );
+		return (NULL);
+	}
+
+    return (void*)pMtx;
+}
+
+/*
+// Delete the mutex.
+//
+// RETURNS: N/A.
+*/
+void mutexDelete( HANDLE handle )
+{
+	OSMutex *pMtx = (OSMutex*)handle;
+	
+	if (pMtx == NULL) return;
+	
+	pthread_mutex_destroy(&pMtx->lock);
+	
+	MEMDEL((char*)handle);
+}
+
+/*
+// Pend on the mutex until an absolute deadline of CLOCK_MONOTONIC.
+//
+// Priority inheritance mutexes are timed on CLOCK_REALTIME by the kernel,
+// the deadline is converted for them.
+//
+// RETURNS: 0-success, or error number
+*/
+LOCAL int mutexPend( OSMutex *pMtx, UINT64 deadline )
+{
+	struct timespec abstm;
+	UINT64 now, left, since;
+	int status;
+
+	/* only contended locks are accounted as blocks, EOWNERDEAD holds it */
+	status = pthread_mutex_trylock(&pMtx->lock);
+	if (status != EBUSY)
+		return status;
+
+	since = OSA_fastNs();
+	if (deadline == DEADLINE_FOREVER)
+	{
+		status = pthread_mutex_lock(&pMtx->lock);
+	}
+	else if (!(pMtx->options & MUTEX_OPT_INHERIT))
+	{
+		OSA_deadlineTime(&abstm, deadline);
+		status = pthread_mutex_clocklock(&pMtx->lock, CLOCK_MONOTONIC, &abstm);
+	}
+	else
+	{
+		now  = OSA_nowNs();
+		left = (deadline > now) ? (deadline - now) : 0;
+		clock_gettime(CLOCK_REALTIME, &abstm);
+		abstm.tv_sec  += (time_t)(left / 1000000000ULL);
+		abstm.tv_nsec += (long)(left % 1000000000ULL);
+		if (abstm.tv_nsec >= 1000000000)
+		{
+			abstm.tv_sec  += 1;
+			abstm.tv_nsec -= 1000000000;
+		}
+		status = pthread_mutex_timedlock(&pMtx->lock, &abstm);
+	}
+
+	if (status == ETIMEDOUT) OSA_statWakeup( deadline );
+	OSA_statBlocked( since );
+
+	return status;
+}
+
+/*
+// Lock the mutex.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+STATUS mutexLock( HANDLE handle, int tminms )
+{
+	return mutexLockUntil( handle, OSA_deadline(tminms) );
+}
+
+/*
+// Lock the mutex before an absolute deadline of CLOCK_MONOTONIC.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+STATUS mutexLockUntil( HANDLE handle, UINT64 deadline )
+{
+	OSMutex *pMtx = (OSMutex*)handle;
+	int status = 0;
+	int spin;
+
+	if (handle==NULL) return ERROR;
+    
+    /* non-blocking lock */
+  	if(deadline == DEADLINE_NO_WAIT) 
+	{
+  		status = pthread_mutex_trylock(&pMtx->lock);
+  	}
+	/* adaptive lock, retry while the owner is likely to release soon */
+	else if (pMtx->spin > 0)
+	{
+		for (spin = pMtx->spin; spin > 0; spin--)
+		{
+			status = pthread_mutex_trylock(&pMtx->lock);
+			if (status != EBUSY) break;
+			OSA_CPU_RELAX();
+		}
+		__atomic_add_fetch(&pMtx->spinStats.spins, 1, __ATOMIC_RELAXED);
+		if (spin > 0)
+			__atomic_add_fetch(&pMtx->spinStats.spinHits, 1, __ATOMIC_RELAXED);
+		else
+			__atomic_add_fetch(&pMtx->spinStats.blocks, 1, __ATOMIC_RELAXED);
+	}
+	/* blocking lock */
+	else
+	{
+		status = EBUSY;
+	}
+
+	/* pending lock */
+	if ((status == EBUSY) && (deadline != DEADLINE_NO_WAIT))
+		status = mutexPend( pMtx, deadline );
+
+	/* the owner died, the state it protects is up to the new owner */
+	if (status == EOWNERDEAD)
+	{
+		status = pthread_mutex_consistent(&pMtx->lock);
+		if (status == 0) pMtx->ownerDied = TRUE;
+	}
+	else if (status == 0)
+	{
+		pMtx->ownerDied = FALSE;
+	}
+
+	return status ? ERROR : OK;
+}
+
+/*
+// Release the mutex.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+STATUS mutexUnlock( HANDLE handle )
+{
+	OSMutex *pMtx = (OSMutex*)handle;
+
+	if (handle==NULL) return ERROR;
+
+	return pthread_mutex_unlock(&pMtx->lock) ? ERROR : OK;
+}
+
+/*
+// Check if the previous owner died holding the mutex, called by the 
+// owner.
+//
+// RETURNS: TRUE if the owner died, otherwize FALSE.
+*/
+BOOL mutexOwnerDied( HANDLE handle )
+{
+	OSMutex *pMtx = (OSMutex*)handle;
+
+	if (handle==NULL) return FALSE;
+
+	return pMtx->ownerDied;
+}
+
+/*
+// Get spin statistics of an adaptive mutex.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+STATUS mutexGetSpinStats( HANDLE handle, OSA_SPIN_STATS *stats )
+{
+	OSMutex *pMtx = (OSMutex*)handle;
+
+	if ((handle==NULL) || (stats == NULL)) return ERROR;
+
+	OSA_spinStats( &pMtx->spinStats, stats );
+
+	return OK;
+}
+
+/********************************************************************************
+// L I N U X  R W L O C K  R O U T I N E S
+********************************************************************************/
+
+/* reader slot of the calling task, assigned at its first read lock */
+LOCAL __thread int rwlockSlotOfTask = -1;
+LOCAL UINT32 rwlockSlotNext = 0;
+
+/*
+// Get the reader slot of the calling task.
+//
+// Tasks take slots in turn, so that up to RWLOCK_SLOTS readers never
+// write the same cache line.
+//
+// RETURNS: reader slot.
+*/
+LOCAL OSRwSlot *rwlockSlot( OSRwLock *pRw )
+{
+	if (rwlockSlotOfTask < 0)
+		rwlockSlotOfTask = (int)(__atomic_fetch_add(&rwlockSlotNext, 1, 
+		                         __ATOMIC_RELAXED) % RWLOCK_SLOTS);
+
+	return &pRw->slots[rwlockSlotOfTask];
+}
+
+/*
+// Count read locks held in all slots.
+//
+// RETURNS: number of readers.
+*/
+LOCAL INT32 rwlockReaders( OSRwLock *pRw )
+{
+	INT32 readers = 0;
+	int i;
+
+	for (i = 0; i < RWLOCK_SLOTS; i++)
+		readers += __atomic_load_n(&pRw->slots[i].readers, __ATOMIC_SEQ_CST);
+
+	return readers;
+}
+
+/*
+// Pend until no writer holds or waits for the rwlock, or the deadline expires.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+LOCAL STATUS rwlockPendWriters( OSRwLock *pRw, UINT64 deadline )
+{
+	INT32 writers;
+	int status;
+
+	for (;;)
+	{
+		__atomic_add_fetch(&pRw->rdWaiters, 1, __ATOMIC_SEQ_CST);
+
+		status  = 0;
+		writers = __atomic_load_n(&pRw->writers, __ATOMIC_SEQ_CST);
+		if (writers != 0)
+			status = OSA_futexWait(&pRw->writers, writers, deadline);
+
+		__atomic_sub_fetch(&pRw->rdWaiters, 1, __ATOMIC_RELAXED);
+
+		if (__atomic_load_n(&pRw->writers, __ATOMIC_SEQ_CST) == 0) return OK;
+		if ((status != 0) && (errno == ETIMEDOUT)) return ERROR;
+	}
+}
+
+/*
+// Take the owner word, pending on it until the deadline expires.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+LOCAL STATUS rwlockTakeOwner( OSRwLock *pRw, UINT64 deadline )
+{
+	INT32 expected;
+	int status = 0;
+
+	for (;;)
+	{
+		expected = 0;
+		if (__atomic_compare_exchange_n(&pRw->owner, &expected, 1, FALSE,
+		                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+			return OK;
+
+		if ((deadline == DEADLINE_NO_WAIT) || 
+		    ((status != 0) && (errno == ETIMEDOUT)))
+			return ERROR;
+
+		__atomic_add_fetch(&pRw->wrWaiters, 1, __ATOMIC_SEQ_CST);
+		status = OSA_futexWait(&pRw->owner, 1, deadline);
+		__atomic_sub_fetch(&pRw->wrWaiters, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/*
+// Drop a read lock of the slot, and hand over to a writer draining readers.
+//
+// RETURNS: N/A.
+*/
+LOCAL void rwlockLeave( OSRwLock *pRw, OSRwSlot *pSlot )
+{
+	__atomic_sub_fetch(&pSlot->readers, 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&pRw->owner, __ATOMIC_SEQ_CST) != 0)
+	{
+		__atomic_add_fetch(&pRw->drain, 1, __ATOMIC_SEQ_CST);
+		OSA_futexWake(&pRw->drain, 1);
+	}
+}
+
+/*
+// Withdraw a writer, hand the owner word to the next writer if it holds it,
+// or let readers in after the last writer.
+//
+// RETURNS: N/A.
+*/
+LOCAL void rwlockRelease( OSRwLock *pRw, BOOL owner )
+{
+	if (owner)
+	{
+		__atomic_store_n(&pRw->owner, 0, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&pRw->wrWaiters, __ATOMIC_SEQ_CST) > 0)
+			OSA_futexWake(&pRw->owner, 1);
+	}
+
+	if ((__atomic_sub_fetch(&pRw->writers, 1, __ATOMIC_SEQ_CST) == 0) &&
+	    (__atomic_load_n(&pRw->rdWaiters, __ATOMIC_SEQ_CST) > 0))
+		OSA_futexWake(&pRw->writers, INT32_MAX);
+}
+
+/*
+// Create a reader-writer lock.
+//
+// Each reader counts itself in a slot of its own cache line, a read lock
+// and unlock touch no line shared with readers of other slots.  A writer
+// counts itself in the writers word first, which turns new readers away
+// as long as any writer holds or waits, then takes the owner word and 
+// waits for the counters of all slots to drain.
+//
+// RETURNS: Handle to rwlock.
+*/
+HANDLE rwlockCreate( void )
+{
+	OSRwLock *pRw = (OSRwLock*)MEMNEW(sizeof(OSRwLock));
+
+	if (pRw == NULL) return (NULL);
+
+	bfillBytes( (char*) pRw, sizeof (*pRw), 0 );
+
+	return (HANDLE)pRw;
+}
+
+/*
+// Delete the rwlock.
+//
+// RETURNS: N/A.
+*/
+void rwlockDelete( HANDLE handle )
+{
+	if (handle == NULL) return;
+
+	MEMDEL((char*)handle);
+}
+
+/*
+// Lock the rwlock for reading.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+STATUS rwlockReadLock( HANDLE handle, int tminms )
+{
+	return rwlockReadLockUntil( handle, OSA_deadline(tminms) );
+}
+
+/*
+// Lock the rwlock for reading before an absolute deadline of CLOCK_MONOTONIC.
+//
+// A reader counts itself before it checks the writers word, and a writer
+// counts itself there before it counts readers, so that either the reader
+// backs off or the writer waits for it.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+STATUS rwlockReadLockUntil( HANDLE handle, UINT64 deadline )
+{
+	OSRwLock *pRw = (OSRwLock*)handle;
+	OSRwSlot *pSlot;
+
+	if (handle==NULL) return ERROR;
+
+	pSlot = rwlockSlot( pRw );
+
+	for (;;)
+	{
+		__atomic_add_fetch(&pSlot->readers, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&pRw->writers, __ATOMIC_SEQ_CST) == 0) return OK;
+
+		/* a writer holds or waits, give way to it */
+		rwlockLeave( pRw, pSlot );
+
+		if (deadline == DEADLINE_NO_WAIT) return ERROR;
+		if (rwlockPendWriters( pRw, deadline ) != OK) return ERROR;
+	}
+}
+
+/*
+// Release a read lock of the rwlock, taken by the calling task.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+STATUS rwlockReadUnlock( HANDLE handle )
+{
+	OSRwLock *pRw = (OSRwLock*)handle;
+
+	if (handle==NULL) return ERROR;
+
+	rwlockLeave( pRw, rwlockSlot( pRw ) );
+
+	return OK;
+}
+
+/*
+// Lock the rwlock for writing.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+STATUS rwlockWriteLock( HANDLE handle, int tminms )
+{
+	return rwlockWriteLockUntil( handle, OSA_deadline(tminms) );
+}
+
+/*
+// Lock the rwlock for writing before an absolute deadline of CLOCK_MONOTONIC.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+STATUS rwlockWriteLockUntil( HANDLE handle, UINT64 deadline )
+{
+	OSRwLock *pRw = (OSRwLock*)handle;
+	INT32 drain;
+	int status = 0;
+
+	if (handle==NULL) return ERROR;
+
+	/* new readers back off from now on */
+	__atomic_add_fetch(&pRw->writers, 1, __ATOMIC_SEQ_CST);
+
+	/* one writer at a time */
+	if (rwlockTakeOwner( pRw, deadline ) != OK)
+	{
+		rwlockRelease( pRw, FALSE );
+		return ERROR;
+	}
+
+	/* wait for the readers inside to leave */
+	for (;;)
+	{
+		drain = __atomic_load_n(&pRw->drain, __ATOMIC_SEQ_CST);
+		if (rwlockReaders( pRw ) == 0) return OK;
+
+		if ((deadline == DEADLINE_NO_WAIT) || 
+		    ((status != 0) && (errno == ETIMEDOUT)))
+		{
+			rwlockRelease( pRw, TRUE );
+			return ERROR;
+		}
+
+		status = OSA_futexWait(&pRw->drain, drain, deadline);
+	}
+}
+
+/*
+// Release the write lock of the rwlock.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+STATUS rwlockWriteUnlock( HANDLE handle )
+{
+	OSRwLock *pRw = (OSRwLock*)handle;
+
+	if (handle==NULL) return ERROR;
+
+	rwlockRelease( pRw, TRUE );
+
+	return OK;
+}
+
+/********************************************************************************
+// L I N U X  R C U  R O U T I N E S
+********************************************************************************/
+
+#define RCU_POLL_YIELDS 100 /* yields before a grace period wait sleeps */
+#define RCU_POLL_NS  100000 /* sleep between checks of a grace period */
+#define RCU_BATCH        64 /* callbacks sharing one grace period */
+#define RCU_FLUSH_MS     10 /* period of the flush timer while callbacks wait */
+
+LOCAL pthread_mutex_t rcuLock = PTHREAD_MUTEX_INITIALIZER;
+LOCAL pthread_once_t  rcuOnce = PTHREAD_ONCE_INIT;
+LOCAL pthread_key_t    rcuKey; /* unregisters readers of exiting tasks */
+LOCAL DL_LIST      rcuReaders; /* registered readers, under rcuLock */
+LOCAL SL_LIST      rcuPending; /* callbacks in grace period order, under rcuLock */
+LOCAL SL_LIST         rcuNext; /* callbacks of the open batch, under rcuLock */
+LOCAL int          rcuNumNext; /* number of callbacks of the open batch */
+LOCAL HANDLE    rcuFlushTimer; /* flushes callbacks of quiet writers */
+LOCAL BOOL      rcuFlushArmed; /* flush timer started, under rcuLock */
+LOCAL volatile UINT64   rcuGp = 1; /* current grace period */
+LOCAL BOOL      rcuMembarrier = FALSE; /* writers fence readers by membarrier */
+LOCAL __thread OSRcuReader *rcuSelf = NULL;
+
+/*
+// Unregister the reader of an exiting task.
+//
+// RETURNS: N/A.
+*/
+LOCAL void rcuExit( void *arg )
+{
+	pthread_mutex_lock(&rcuLock);
+	dllRemove(&rcuReaders, (DL_NODE*)arg);
+	pthread_mutex_unlock(&rcuLock);
+
+	MEMDEL(arg);
+}
+
+LOCAL void rcuFlush( void *arg );
+
+/*
+// Initialize the rcu facility once.
+//
+// With expedited membarrier writers fence all running readers of the 
+// process, and readers need no more than a compiler barrier.  Without it
+// readers fence themselves.
+//
+// RETURNS: N/A.
+*/
+LOCAL void rcuInit( void )
+{
+	pthread_key_create(&rcuKey, rcuExit);
+
+	/* without the timer, callbacks wait for the next rcu call */
+	rcuFlushTimer = timerCreate( rcuFlush, NULL );
+
+#ifdef SYS_membarrier
+	rcuMembarrier = (syscall(SYS_membarrier, 
+	                 MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0);
+#endif
+}
+
+/*
+// Order the counter of a reader entering before the reads of its section.
+//
+// RETURNS: N/A.
+*/
+LOCAL void rcuReaderBarrier( void )
+{
+	if (rcuMembarrier)
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	else
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+// Fence all readers, pairs with rcuReaderBarrier.
+//
+// RETURNS: N/A.
+*/
+LOCAL void rcuWriterBarrier( void )
+{
+#ifdef SYS_membarrier
+	if (rcuMembarrier)
+	{
+		syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+		return;
+	}
+#endif
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+// Register the calling task as a reader.
+//
+// RETURNS: reader, or NULL if failed.
+*/
+LOCAL OSRcuReader *rcuRegister( void )
+{
+	OSRcuReader *pReader;
+
+	pthread_once(&rcuOnce, rcuInit);
+
+	/* own cache line, the writer is the only other task reading it */
+	if (posix_memalign((void**)&pReader, CACHE_LINE_SIZE, sizeof(*pReader)))
+		return NULL;
+
+	bfillBytes( (char*) pReader, sizeof (*pReader), 0 );
+
+	pthread_mutex_lock(&rcuLock);
+	dllAdd(&rcuReaders, &pReader->node);
+	pthread_mutex_unlock(&rcuLock);
+
+	pthread_setspecific(rcuKey, pReader);
+	rcuSelf = pReader;
+
+	return pReader;
+}
+
+/*
+// Start a new grace period, under rcuLock.
+//
+// A reader that does not show up in the scans after this routine either 
+// entered after the new grace period, or reads the pointers published 
+// before this routine.
+//
+// RETURNS: the new grace period.
+*/
+LOCAL UINT64 rcuNewGp( void )
+{
+	UINT64 gp = rcuGp + 1;
+
+	__atomic_store_n(&rcuGp, gp, __ATOMIC_SEQ_CST);
+	rcuWriterBarrier();
+
+	return gp;
+}
+
+/*
+// Close the open batch of callbacks on grace period <gp>, under rcuLock.
+//
+// RETURNS: N/A.
+*/
+LOCAL void rcuCloseAt( UINT64 gp )
+{
+	OSRcuHead *pHead;
+
+	while ((pHead = (OSRcuHead*)sllGet(&rcuNext)) != NULL)
+	{
+		pHead->gp = gp;
+		sllPutAtTail(&rcuPending, &pHead->node);
+	}
+	rcuNumNext = 0;
+}
+
+/*
+// Close the open batch of callbacks on a new grace period, under rcuLock.
+//
+// The callbacks were queued before the grace period starts, so they 
+// share it, and its writer barrier.
+//
+// RETURNS: N/A.
+*/
+LOCAL void rcuClose( void )
+{
+	if (rcuNumNext > 0) rcuCloseAt( rcuNewGp() );
+}
+
+/*
+// Get the oldest grace period some reader is in, under rcuLock.
+//
+// RETURNS: grace period, or ~0 if no reader is in a read section.
+*/
+LOCAL UINT64 rcuOldestReader( void )
+{
+	DL_NODE *pNode;
+	UINT64 ctr, oldest = ~0ULL;
+
+	for (pNode = DLL_FIRST(&rcuReaders); pNode != NULL; pNode = DLL_NEXT(pNode))
+	{
+		ctr = __atomic_load_n(&((OSRcuReader*)pNode)->ctr, __ATOMIC_ACQUIRE);
+		if ((ctr != 0) && (ctr < oldest)) oldest = ctr;
+	}
+
+	return oldest;
+}
+
+/*
+// Move callbacks of grace periods up to <gp> to <pDone>, under rcuLock.
+//
+// RETURNS: N/A.
+*/
+LOCAL void rcuReap( SL_LIST *pDone, UINT64 gp )
+{
+	OSRcuHead *pHead;
+
+	while (((pHead = (OSRcuHead*)SLL_FIRST(&rcuPending)) != NULL) && 
+	       (pHead->gp <= gp))
+		sllPutAtTail(pDone, sllGet(&rcuPending));
+}
+
+/*
+// Call the callbacks of <pDone>, out of rcuLock.
+//
+// RETURNS: N/A.
+*/
+LOCAL void rcuRun( SL_LIST *pDone )
+{
+	OSRcuHead *pHead;
+
+	while ((pHead = (OSRcuHead*)sllGet(pDone)) != NULL)
+	{
+		pHead->func(pHead->arg);
+		MEMDEL(pHead);
+	}
+}
+
+/*
+// Free a memory block, the rcuFree callback.
+//
+// RETURNS: N/A.
+*/
+LOCAL void rcuMemDel( void *ptr )
+{
+	MEMDEL(ptr);
+}
+
+/*
+// Check if the flush timer has to run again, and mark it, under rcuLock.
+//
+// RETURNS: TRUE if the caller has to start the flush timer.
+*/
+LOCAL BOOL rcuFlushDue( void )
+{
+	if (rcuFlushTimer == NULL) return FALSE;
+
+	rcuFlushArmed = (rcuNumNext > 0) || !SLL_EMPTY(&rcuPending);
+
+	return rcuFlushArmed;
+}
+
+/*
+// Flush timer routine, closes the open batch and calls callbacks due, 
+// so that callbacks of a writer that stopped calling rcu routines are not
+// left pending.  It runs again while callbacks wait.
+//
+// RETURNS: N/A.
+*/
+LOCAL void rcuFlush( void *arg )
+{
+	SL_LIST done;
+	BOOL again;
+
+	(void)arg;
+	sllInit(&done);
+
+	pthread_mutex_lock(&rcuLock);
+	rcuClose();
+	rcuReap(&done, rcuOldestReader());
+	again = rcuFlushDue();
+	pthread_mutex_unlock(&rcuLock);
+
+	rcuRun(&done);
+
+	if (again) (void)timerStart( rcuFlushTimer, RCU_FLUSH_MS, 0 );
+}
+
+/*
+// Enter a read section.
+//
+// The outermost section stores the current grace period in the reader's
+// own cache line, no atomic instruction nor shared line is written.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+STATUS rcuReadLock( void )
+{
+	OSRcuReader *pReader = rcuSelf;
+
+	if ((pReader == NULL) && ((pReader = rcuRegister()) == NULL)) return ERROR;
+
+	if (pReader->nest++ == 0)
+	{
+		__atomic_store_n(&pReader->ctr, 
+		                 __atomic_load_n(&rcuGp, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+		rcuReaderBarrier();
+	}
+
+	return OK;
+}
+
+/*
+// Leave a read section.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+STATUS rcuReadUnlock( void )
+{
+	OSRcuReader *pReader = rcuSelf;
+
+	if ((pReader == NULL) || (pReader->nest <= 0)) return ERROR;
+
+	if (--pReader->nest == 0)
+		__atomic_store_n(&pReader->ctr, 0, __ATOMIC_RELEASE);
+
+	return OK;
+}
+
+/*
+// Wait for a grace period, after which no reader holds a pointer 
+// unpublished before this routine.  Callbacks due are called on the way.
+//
+// RETURNS: N/A.
+*/
+void rcuSynchronize( void )
+{
+	struct timespec pollTime = { 0, RCU_POLL_NS };
+	SL_LIST done;
+	UINT64 gp, oldest;
+	int tries;
 
-	if (pMsgQ==NULL) return ERROR;
-	
-	pthread_mutex_lock(&pMsgQ->lock);
-	while(1) 
-    {
-		p_msg = (MSG_NODE*)sllGet( &pMsgQ->qReady );
-		if (p_msg == NULL) 
-        {
-			/* Non-blocking wait, set EAGAIN if message queue is empty.	*/
-			if(tminms == NO_WAIT) 
-            {
-				status = ERROR;
-			}
-			/* Blocking wait */
-			else if (tminms == WAIT_FOREVER) 
-            {
-				status = pthread_cond_wait(&pMsgQ->condrd, &pMsgQ->lock);
-			}
-			/* Timed wait */
-			else 
-            {
-				struct timespec abstm;
-
-		        clock_gettime(CLOCK_REALTIME, &abstm);
-		        abstm.tv_sec  += (tminms / 1000);
-		        abstm.tv_nsec += (tminms % 1000 * 1000000);
-		        status = pthread_cond_timedwait(&pMsgQ->condrd, &pMsgQ->lock, &abstm);
-			}
-			/* Any errors occur, return with errno. */
-		    if (status) break;
-		}
-		else 
-        {
-			nret = MIN(maxnbytes, p_msg->msgLen);
-			bcopyBytes( MSG_NODE_DATA(p_msg), buffer, nret );
-			sllPutAtTail( &pMsgQ->qFree, (SL_NODE*)p_msg );
-			status = pthread_cond_signal(&pMsgQ->condwr);
-			break;
-		}
+	pthread_once(&rcuOnce, rcuInit);
+	sllInit(&done);
+
+	/* the open batch shares the new grace period */
+	pthread_mutex_lock(&rcuLock);
+	gp = rcuNewGp();
+	rcuCloseAt( gp );
+	pthread_mutex_unlock(&rcuLock);
+
+	for (tries = 0; ; tries++)
+	{
+		pthread_mutex_lock(&rcuLock);
+		oldest = rcuOldestReader();
+		if (oldest >= gp) rcuReap(&done, gp);
+		pthread_mutex_unlock(&rcuLock);
+
+		if (oldest >= gp) break;
+
+		/* let readers of lower priority leave */
+		if (tries < RCU_POLL_YIELDS)
+			sched_yield();
+		else
+			nanosleep(&pollTime, NULL);
 	}
-	pthread_mutex_unlock(&pMsgQ->lock);
 
-	return (status ? ERROR : nret);
+	rcuRun(&done);
 }
 
 /*
-// mqCount - get the number of messages queued to a message queue
+// Call <func> with <arg> after a grace period.
 //
-// RETURNS: The number of messages queued, or ERROR.
+// Callbacks are queued in an open batch, which is closed on one new grace
+// period once RCU_BATCH callbacks are queued, by rcuSynchronize, or by
+// the flush timer within RCU_FLUSH_MS.  A callback is called by a later
+// rcuCall, rcuSynchronize, rcuBarrier or the flush timer once no reader
+// is older than its grace period.  The caller is never blocked, it may
+// be in a read section.
+//
+// RETURNS: OK-success, otherwize ERROR
 */
-int 
-mqCount( HANDLE handle )
+STATUS rcuCall( void (*func)(void*), void *arg )
 {
-	OSMessageQueue* pMsgQ = (OSMessageQueue*)handle;
-	int     count = 0;
-	
-	if (pMsgQ==NULL) return 0;
+	OSRcuHead *pHead;
+	SL_LIST done;
+	BOOL flush = FALSE;
 
-	pthread_mutex_lock(&pMsgQ->lock);
-	count = sllCount( &pMsgQ->qReady );
-	pthread_mutex_unlock(&pMsgQ->lock);
-  
-	return count;
+	if (func == NULL) return ERROR;
+
+	pthread_once(&rcuOnce, rcuInit);
+
+	pHead = (OSRcuHead*)MEMNEW(sizeof(OSRcuHead));
+	if (pHead == NULL) return ERROR;
+
+	pHead->func = func;
+	pHead->arg  = arg;
+	sllInit(&done);
+
+	pthread_mutex_lock(&rcuLock);
+	sllPutAtTail(&rcuNext, &pHead->node);
+	if (++rcuNumNext >= RCU_BATCH) rcuClose();
+	rcuReap(&done, rcuOldestReader());
+	if (!rcuFlushArmed) flush = rcuFlushDue();
+	pthread_mutex_unlock(&rcuLock);
+
+	rcuRun(&done);
+
+	if (flush) (void)timerStart( rcuFlushTimer, RCU_FLUSH_MS, 0 );
+
+	return OK;
+}
+
+/*
+// Release a memory block got by MEMNEW after a grace period.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+STATUS rcuFree( void *ptr )
+{
+	if (ptr == NULL) return OK;
+
+	return rcuCall( rcuMemDel, ptr );
+}
+
+/*
+// Wait until all callbacks queued before are called.
+//
+// The grace period of rcuSynchronize closes the open batch, and is newer
+// than those of the batches closed before, so it reaps them all.
+//
+// RETURNS: N/A.
+*/
+void rcuBarrier( void )
+{
+	rcuSynchronize();
 }
 
 /********************************************************************************
-// L I N U X  M U T E X  R O U T I N E S
+// L I N U X  S E M A P H O R E  R O U T I N E S
 ********************************************************************************/
 /*
-// Create a mutex.
+// Create a semaphore.
 //
-// RETURNS: Handle to mutex.
+// RETURNS: Handle to semaphore.
 */
-HANDLE mutexCreate( void )
+HANDLE semCreate( int count )
 {
-	OSMutex *pMtx = (OSMutex*)MEMNEW(sizeof(OSMutex));
-	
-	if (pMtx == NULL) return (NULL);
+	return semCreateEx( count, 0, 0 );
+}
+
+/*
+// Create a semaphore with options.
+//
+// The count is a futex word, uncontended waits and posts are a single
+// atomic operation.  With SEM_OPT_ADAPTIVE a waiter polls the count for 
+// <spin> rounds, or OSA_SPIN_DEFAULT rounds if <spin> is 0, before it sleeps.
+//
+// RETURNS: Handle to semaphore.
+*/
+HANDLE semCreateEx( int count, int options, int spin )
+{
+	OSSemaphore *pSem = (OSSemaphore*)MEMNEW(sizeof(OSSemaphore));
 	
-	if (pthread_mutex_init(&pMtx->lock, NULL))
+	if ((pSem == NULL) || (count < 0))
 	{
-		MEMDEL( pMtx );
+		if (pSem != NULL) MEMDEL( pSem );
 		return (NULL);
 	}
+	
+	bfillBytes( (char*) pSem, sizeof (*pSem), 0 );
+	pSem->spin  = OSA_spinBudget( (options & SEM_OPT_ADAPTIVE) != 0, spin );
+	pSem->count = count;
 
-    return (void*)pMtx;
+    return (HANDLE)pSem;
 }
 
 /*
-// Delete the mutex.
+// Delete the semaphore, and release the related rsrc.
 //
 // RETURNS: N/A.
 */
-void mutexDelete( HANDLE handle )
+void semDelete( HANDLE handle )
 {
-	OSMutex *pMtx = (OSMutex*)handle;
-	
-	if (pMtx == NULL) return;
+	OSSemaphore *pSem = (OSSemaphore*)handle;
 	
-	pthread_mutex_destroy(&pMtx->lock);
+	if (pSem == NULL) return;
 	
-	MEMDEL((char*)handle);
+	pSem->count   = 0;
+
+	MEMDEL((char*)pSem);
 }
 
 /*
-// Lock the mutex.
+// Take <n> counts of the semaphore at once, if available.
+//
+// RETURNS: TRUE if taken, otherwize FALSE
+*/
+LOCAL BOOL semTryTake( OSSemaphore *pSem, INT32 n, INT32 *pCount )
+{
+	INT32 count = __atomic_load_n(&pSem->count, __ATOMIC_RELAXED);
+
+	while (count >= n)
+	{
+		if (__atomic_compare_exchange_n(&pSem->count, &count, count - n, TRUE, 
+		                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return TRUE;
+	}
+
+	*pCount = count;
+
+	return FALSE;
+}
+
+/*
+// Take <n> counts of the semaphore before an absolute deadline.
+//
+// A waiter registers itself before it checks the count again and sleeps
+// on the count word, so that a post either is seen by the check, or
+// finds the waiter and wakes it up.
 //
 // RETURNS: OK-success, otherwize ERROR
 */
-STATUS mutexLock( HANDLE handle, int tminms )
+LOCAL STATUS semTake( OSSemaphore *pSem, INT32 n, UINT64 deadline )
 {
-	OSMutex *pMtx = (OSMutex*)handle;
+	INT32 count;
 	int status = 0;
 
-	if (handle==NULL) return ERROR;
-    
-    /* non-blocking lock */
-  	if(tminms == NO_WAIT) 
-	{
-  		status = pthread_mutex_trylock(&pMtx->lock);
-  	}
-    /* blocking lock */
-	else if (tminms == WAIT_FOREVER)
-	{
-  		status = pthread_mutex_lock(&pMtx->lock);
-  	}
-  	/* timed lock */
-	else 
+	if (semTryTake( pSem, n, &count )) return OK;
+	if (deadline == DEADLINE_NO_WAIT) return ERROR;
+
+	if ((pSem->spin > 0) && 
+	    OSA_spinFor( &pSem->count, n, pSem->spin, &pSem->spinStats ) &&
+	    semTryTake( pSem, n, &count ))
+		return OK;
+
+	for (;;)
 	{
-		struct timespec abstm;
-		
-		clock_gettime(CLOCK_REALTIME, &abstm);
-		abstm.tv_sec  += (tminms / 1000);
-		abstm.tv_nsec += (tminms % 1000 * 1000000);
-		status = pthread_mutex_timedlock(&pMtx->lock, &abstm);
-	}
+		__atomic_add_fetch(&pSem->waiters, 1, __ATOMIC_SEQ_CST);
+		if (n > 1) __atomic_add_fetch(&pSem->bigWaiters, 1, __ATOMIC_SEQ_CST);
 
-	return status ? ERROR : OK;
+		status = 0;
+		count  = __atomic_load_n(&pSem->count, __ATOMIC_SEQ_CST);
+		if (count < n)
+		{
+			if (pSem->spin > 0)
+				__atomic_add_fetch(&pSem->spinStats.blocks, 1, __ATOMIC_RELAXED);
+			status = OSA_futexWait(&pSem->count, count, deadline);
+		}
+
+		if (n > 1) __atomic_sub_fetch(&pSem->bigWaiters, 1, __ATOMIC_RELAXED);
+		__atomic_sub_fetch(&pSem->waiters, 1, __ATOMIC_RELAXED);
+
+		if (semTryTake( pSem, n, &count )) return OK;
+		if ((status != 0) && (errno == ETIMEDOUT)) return ERROR;
+	}
 }
 
 /*
-// Release the mutex.
+// Wait the semaphore.
 //
 // RETURNS: OK-success, otherwize ERROR
 */
-STATUS mutexUnlock( HANDLE handle )
+STATUS semWait( HANDLE handle, int tminms )
 {
-	OSMutex *pMtx = (OSMutex*)handle;
+	return semWaitUntil( handle, OSA_deadline(tminms) );
+}
 
+/*
+// Wait the semaphore until an absolute deadline of CLOCK_MONOTONIC.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+STATUS semWaitUntil( HANDLE handle, UINT64 deadline )
+{
 	if (handle==NULL) return ERROR;
+	
+	return semTake( (OSSemaphore*)handle, 1, deadline );
+}
 
-	return pthread_mutex_unlock(&pMtx->lock) ? ERROR : OK;
+/*
+// Wait <n> counts of the semaphore, they are taken all at once.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+STATUS semWaitN( HANDLE handle, int n, int tminms )
+{
+	if ((handle==NULL) || (n <= 0)) return ERROR;
+	
+	return semTake( (OSSemaphore*)handle, n, OSA_deadline(tminms) );
 }
 
-/********************************************************************************
-// L I N U X  S E M A P H O R E  R O U T I N E S
-********************************************************************************/
 /*
-// Create a semaphore.
+// Post the semaphore.
 //
-// RETURNS: Handle to semaphore.
+// RETURNS: OK-success, otherwize ERROR
 */
-HANDLE semCreate( int count )
+STATUS semPost( HANDLE handle )
 {
-	int status = 0;
-	OSSemaphore *pSem = (OSSemaphore*)MEMNEW(sizeof(OSSemaphore));
+	return semPostN( handle, 1 );
+}
+
+/*
+// Post <n> counts of the semaphore at once.
+//
+// No wakeup while nobody waits.  Up to <n> waiters are woken up, or all
+// of them while some waits for several counts, as the first one woken up
+// may not be satisfied and the rest would miss the counts.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+STATUS semPostN( HANDLE handle, int n )
+{
+	OSSemaphore *pSem = (OSSemaphore*)handle;
+	INT32 waiters;
 	
-	if (pSem == NULL) return (NULL);
+	if ((handle==NULL) || (n <= 0)) return ERROR;
 	
-	status = pthread_mutex_init( &pSem->lock, NULL );
-	status |= pthread_cond_init( &pSem->cond, NULL );
-	if (status) 
+	__atomic_add_fetch(&pSem->count, n, __ATOMIC_SEQ_CST);
+
+	waiters = __atomic_load_n(&pSem->waiters, __ATOMIC_SEQ_CST);
+	if (waiters > 0)
 	{
-		MEMDEL( pSem );
-		return (NULL);
+		if (__atomic_load_n(&pSem->bigWaiters, __ATOMIC_SEQ_CST) > 0)
+			waiters = INT32_MAX;
+		if (OSA_futexWake(&pSem->count, MIN(n, waiters)) < 0)
+			return ERROR;
 	}
+	
+	return OK;
+}
 
-	pSem->count = count;
+/* 
+// Get semaphore count.
+//
+// RETURNS: count of current semaphore.
+*/
+int semCount( HANDLE handle )
+{
+	OSSemaphore *pSem = (OSSemaphore*)handle;
+	
+	if (handle==NULL) return -1;
 
-    return (HANDLE)pSem;
+	return __atomic_load_n(&pSem->count, __ATOMIC_RELAXED);
 }
 
 /*
-// Delete the semaphore, and release the related rsrc.
+// Get spin statistics of an adaptive semaphore.
 //
-// RETURNS: N/A.
+// RETURNS: OK-success, otherwize ERROR
 */
-void semDelete( HANDLE handle )
+STATUS semGetSpinStats( HANDLE handle, OSA_SPIN_STATS *stats )
 {
 	OSSemaphore *pSem = (OSSemaphore*)handle;
-	
-	if (pSem == NULL) return;
-	
-	pSem->count   = 0;
-	pthread_cond_destroy(&pSem->cond);
-	pthread_mutex_destroy(&pSem->lock);
 
-	MEMDEL((char*)pSem);
+	if ((handle==NULL) || (stats == NULL)) return ERROR;
+
+	OSA_spinStats( &pSem->spinStats, stats );
+
+	return OK;
+}
+
+/********************************************************************************
+// L I N U X  T H R E A D  R O U T I N E S
+********************************************************************************/
+
+/* list of tasks created, for statistics */
+LOCAL DL_LIST tskList;
+LOCAL pthread_mutex_t tskListLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Thread execute function. */
+static int doExecute( OSTask* pTask )
+{
+	/* the creator may not have stored it yet, tskSelf needs it */
+	pTask->tid = pthread_self();
+	pTask->kid = (pid_t)syscall(SYS_gettid);
+	osaStatsSelf = &pTask->stats;
+    errno = 0;
+	/* default cancel type is anynchronous */
+    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+	/* realy call task function */
+	return (*pTask->entry)(pTask->param);
+}
+
+/*
+// Convert a cpu mask to a cpu set.
+//
+// RETURNS: N/A.
+*/
+LOCAL void tskCpuSet( cpu_set_t *pSet, UINT64 cpus )
+{
+	int cpu;
+
+	CPU_ZERO(pSet);
+	for (cpu = 0; cpu < OSA_MAX_CPUS; cpu++)
+		if (cpus & (1ULL << cpu)) CPU_SET(cpu, pSet);
+}
+
+/* stack pool, free stacks and stacks of threads exited but not joined */
+LOCAL DL_LIST stkFree;
+LOCAL DL_LIST stkRetired;
+LOCAL int stkNumFree;
+LOCAL pthread_mutex_t stkLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+// Unmap a stack and its guard page.
+//
+// RETURNS: N/A.
+*/
+LOCAL void stkUnmap( OSStack *pStack )
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+	munmap(pStack->base - page, pStack->size + page);
+	MEMDEL( pStack );
+}
+
+/*
+// Put a stack no thread runs on in the pool, under lock.
+//
+// RETURNS: N/A.
+*/
+LOCAL void stkPut( OSStack *pStack )
+{
+	if (stkNumFree >= STACK_POOL_SIZE)
+	{
+		stkUnmap( pStack );
+		return;
+	}
+
+	dllAdd(&stkFree, &pStack->node);
+	stkNumFree++;
+}
+
+/*
+// Move the stacks of retired threads that finished exiting to the pool, 
+// under lock.
+//
+// RETURNS: N/A.
+*/
+LOCAL void stkReap( void )
+{
+	DL_NODE *pNode, *pNext;
+
+	for (pNode = DLL_FIRST(&stkRetired); pNode != NULL; pNode = pNext)
+	{
+		pNext = DLL_NEXT(pNode);
+		if (pthread_tryjoin_np(((OSStack*)pNode)->tid, NULL) != 0) continue;
+
+		dllRemove(&stkRetired, pNode);
+		stkPut( (OSStack*)pNode );
+	}
+}
+
+/*
+// Fill a stack with STACK_PATTERN, for high-water measurement.
+//
+// RETURNS: N/A.
+*/
+LOCAL void stkFill( OSStack *pStack )
+{
+	UINT32 *pWord;
+
+	for (pWord = (UINT32*)pStack->base; 
+	     pWord < (UINT32*)(pStack->base + pStack->size); pWord++)
+		*pWord = STACK_PATTERN;
 }
 
 /*
-// Wait the semaphore.
+// Get a stack of <size> bytes from the pool, or map a new one.
 //
-// RETURNS: OK-success, otherwize ERROR
+// The stack is filled with STACK_PATTERN, which faults all its pages in
+// before the task runs, and a guard page below it catches overflows.
+//
+// RETURNS: stack, or NULL if failed.
 */
-STATUS semWait( HANDLE handle, int tminms )
+LOCAL OSStack *stkAlloc( size_t size )
 {
-	OSSemaphore *pSem = (OSSemaphore*)handle;
-	int status = OK;
-	
-	if (handle==NULL) return ERROR;
-	
-	pthread_mutex_lock(&pSem->lock);
-	
-	if(pSem->count <= 0)
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	OSStack *pStack = NULL;
+	DL_NODE *pNode;
+	char *mem;
+
+	if (size < (size_t)PTHREAD_STACK_MIN) size = (size_t)PTHREAD_STACK_MIN;
+	size = (size + page - 1) & ~(page - 1);
+
+	pthread_mutex_lock(&stkLock);
+	stkReap();
+	for (pNode = DLL_FIRST(&stkFree); pNode != NULL; pNode = DLL_NEXT(pNode))
 	{
-		if(tminms == NO_WAIT)
-		{
-			status = ERROR;
-		}
-		else if (tminms == WAIT_FOREVER) 
+		if (((OSStack*)pNode)->size != size) continue;
+
+		dllRemove(&stkFree, pNode);
+		stkNumFree--;
+		pStack = (OSStack*)pNode;
+		break;
+	}
+	pthread_mutex_unlock(&stkLock);
+
+	if (pStack == NULL)
+	{
+		pStack = (OSStack*)MEMNEW(sizeof(OSStack));
+		if (pStack == NULL) return (NULL);
+
+		mem = mmap(NULL, size + page, PROT_READ | PROT_WRITE, 
+		           MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+		if (mem == MAP_FAILED)
 		{
-			status = pthread_cond_wait(&pSem->cond, &pSem->lock);
+			MEMDEL( pStack );
+			return (NULL);
 		}
-		/* Timed wait */
-		else 
-		{
-			struct timespec abstm;
+		(void)mprotect(mem, page, PROT_NONE);
 
-	 		/* Get absolute time */
-			clock_gettime(CLOCK_REALTIME, &abstm);
-			abstm.tv_sec  += (tminms / 1000);
-			abstm.tv_nsec += (tminms % 1000 * 1000000);
-			status = pthread_cond_timedwait(&pSem->cond, &pSem->lock, &abstm);
-		}
+		pStack->base = mem + page;
+		pStack->size = size;
 	}
-	-- pSem->count;
-	pthread_mutex_unlock(&pSem->lock);
-	
-	return (status ? ERROR : OK);
+
+	stkFill( pStack );
+
+	return pStack;
 }
 
 /*
-// Post the semaphore.
+// Release a stack of a task.
 //
-// RETURNS: OK-success, otherwize ERROR
+// The stack of the calling thread is retired until the thread has exited,
+// as it still runs on it.
+//
+// RETURNS: N/A.
 */
-STATUS semPost( HANDLE handle )
+LOCAL void stkRelease( OSStack *pStack, BOOL self )
 {
-	int status = 0;
-	OSSemaphore *pSem = (OSSemaphore*)handle;
-	
-	if (handle==NULL) return ERROR;
-	
-	pthread_mutex_lock(&pSem->lock);
-	++ pSem->count;
-	status = pthread_cond_signal(&pSem->cond);
-	pthread_mutex_unlock(&pSem->lock);
-	
-	return status ? ERROR : OK;
+	pthread_mutex_lock(&stkLock);
+	if (self)
+	{
+		pStack->tid = pthread_self();
+		dllAdd(&stkRetired, &pStack->node);
+	}
+	else
+	{
+		stkPut( pStack );
+	}
+	pthread_mutex_unlock(&stkLock);
 }
 
-/* 
-// Get semaphore count.
+/*
+// Measure the deepest use of a stack, it grows down from the top.
 //
-// RETURNS: count of current semaphore.
+// RETURNS: number of bytes used.
 */
-int semCount( HANDLE handle )
+LOCAL UINT32 stkHighWater( OSStack *pStack )
 {
-	OSSemaphore *pSem = (OSSemaphore*)handle;
-	int count = -1;
-	
-	if (handle==NULL) return -1;
-	pthread_mutex_lock(&pSem->lock);
-	count = pSem->count;
-	pthread_mutex_unlock(&pSem->lock);
-	
-	return count;
-}
+	UINT32 *pWord = (UINT32*)pStack->base;
+	UINT32 *pTop = (UINT32*)(pStack->base + pStack->size);
 
-/********************************************************************************
-// L I N U X  T H R E A D  R O U T I N E S
-********************************************************************************/
+	while ((pWord < pTop) && (*pWord == STACK_PATTERN)) pWord++;
 
-/* Thread execute function. */
-static int doExecute( OSTask* pTask )
-{
-    errno = 0;
-	/* default cancel type is anynchronous */
-    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-	/* realy call task function */
-	return (*pTask->entry)(pTask->param);
+	return (UINT32)((char*)pTop - (char*)pWord);
 }
 
 /*
@@ -836,13 +4296,15 @@ static int doExecute( OSTask* pTask )
 //
 // RETURNS: 0-success, otherwize ERROR
 */
-LOCAL int tskInit( OSTask *const pTask, int prio, int stksz, int(*entry)(void*), void *arg )
+LOCAL int tskInit( OSTask *const pTask, int prio, int stksz, int(*entry)(void*), void *arg, UINT64 cpus )
 {
 	struct sched_param param;
+	cpu_set_t set;
 	int status = 0;
 	
 	if(pTask==NULL) return ERROR;
-	
+
+	pTask->pStack = NULL;
 	status = pthread_attr_init(&pTask->attr);
 	if (status) return ERROR;
 	
@@ -857,13 +4319,22 @@ LOCAL int tskInit( OSTask *const pTask, int prio, int stksz, int(*entry)(void*),
 	param.sched_priority = prio;
 	status |= pthread_attr_setschedparam(&pTask->attr, &param);
 
-	/* set thread stack size */
-	if(stksz != TASK_STACKSIZE_DEFAULT)	
+	/* set thread stack from the stack pool */
+	if(stksz == TASK_STACKSIZE_DEFAULT) stksz = TASK_STACKSIZE_POOL;
+	pTask->pStack = stkAlloc( (size_t)stksz );
+	if (pTask->pStack == NULL) return ERROR;
+	status |= pthread_attr_setstack(&pTask->attr, pTask->pStack->base, pTask->pStack->size);
+
+	/* place the thread before it runs, so that it never migrates */
+	if (cpus != 0)
 	{
-		status |= pthread_attr_setstacksize(&pTask->attr, stksz);
+		tskCpuSet(&set, cpus);
+		status |= pthread_attr_setaffinity_np(&pTask->attr, sizeof(set), &set);
 	}
 	
 	pTask->tid = 0;
+	pTask->kid = 0;
+	bfillBytes( (char*) &pTask->stats, sizeof (pTask->stats), 0 );
 	/* Store task entry and argumnets */
 	pTask->entry = entry;
 	pTask->param = arg;
@@ -874,19 +4345,47 @@ LOCAL int tskInit( OSTask *const pTask, int prio, int stksz, int(*entry)(void*),
 /* Cleanup task memory */
 LOCAL void tskCleanup( HANDLE handle )
 {
+	OSTask* pTask = (OSTask*)handle;
+
+	if (osaStatsSelf == &pTask->stats) osaStatsSelf = NULL;
+
+	/* unlinked first, tskShowAll reads the stack of listed tasks */
+	pthread_mutex_lock(&tskListLock);
+	dllRemove(&tskList, &pTask->node);
+	pthread_mutex_unlock(&tskListLock);
+
+	/* the thread was joined, unless it deletes itself */
+	stkRelease( pTask->pStack, tskSelf( pTask ) );
+
 	MEMDEL((char*)handle);
 }
 
 HANDLE tskCreate( int prio, int stksz, int(*entry)(void*), void *arg )
+{
+	return tskCreateEx( prio, stksz, entry, arg, 0 );
+}
+
+/*
+// Create a task bound to the cpus set in <cpus>, or any cpu if 0.
+//
+// RETURNS: Handle to task, or NULL if failed.
+*/
+HANDLE tskCreateEx( int prio, int stksz, int(*entry)(void*), void *arg, UINT64 cpus )
 {
 	HANDLE handle = (HANDLE)MEMNEW(sizeof(OSTask));
 	
     if (handle == NULL) return (NULL);
-	if (tskInit((OSTask*)handle, prio, stksz, entry, arg ) != OK) 
+	if (tskInit((OSTask*)handle, prio, stksz, entry, arg, cpus ) != OK) 
 	{
+		if (((OSTask*)handle)->pStack != NULL)
+			stkRelease( ((OSTask*)handle)->pStack, FALSE );
 		MEMDEL( handle );
 		return (NULL);
 	}
+
+	pthread_mutex_lock(&tskListLock);
+	dllAdd(&tskList, &((OSTask*)handle)->node);
+	pthread_mutex_unlock(&tskListLock);
 	
     return handle;
 }
@@ -931,7 +4430,7 @@ HANDLE tskSpawn( int prio, int stksz, int(*entry)(void*), void *arg )
 	{
 		OSTask* pTask = (OSTask*)handle;
 		pthread_attr_destroy(&pTask->attr);
-		MEMDEL( handle );
+		tskCleanup( handle );
 		return (NULL);
 	}
 
@@ -961,9 +4460,6 @@ STATUS tskStart( HANDLE handle )
 	return status ? ERROR : OK;
 }
 
-/* Restart assistent thread ID. */
-LOCAL pthread_t taskSelfRestartId = 0;
-
 /* Restart assistent thread routine. */
 LOCAL void* taskSelfRestartFxn( void* arg )
 {
@@ -973,7 +4469,11 @@ LOCAL void* taskSelfRestartFxn( void* arg )
 	// Detach our thread's pthread to clean up memory, 
 	// etc. without a 'join' operation. 
     */
-	pthread_detach(taskSelfRestartId);
+	pthread_detach(pthread_self());
+
+	/* The task restarts on the same stack, wait it to exit first. */
+	(void) pthread_join(pTask->tid, (void **)NULL);
+	stkFill( pTask->pStack );
 
 	/* Start task now. */
 	(void) tskStart(pTask);
@@ -1005,14 +4505,17 @@ STATUS tskRestart( HANDLE handle )
 		if (status) return ERROR;
 
 		pTask->tid = 0;
+		stkFill( pTask->pStack );
 
 		/* Re-create the thread now */
 		status = pthread_create(&pTask->tid, &pTask->attr, (void*(*)(void*))doExecute, pTask);
 	}
 	else 
 	{
+		pthread_t assistant;
+
 		/* If on myself, Create assistant thread to restart myself */
-		status = pthread_create(&taskSelfRestartId, NULL, taskSelfRestartFxn, pTask);
+		status = pthread_create(&assistant, NULL, taskSelfRestartFxn, pTask);
 		if (status) return ERROR;
 		pthread_exit((void*)0);
 	}
@@ -1078,6 +4581,386 @@ int tskGetPriority( HANDLE handle, int *prio )
 	return status ? ERROR : OK;
 }
 
+/* 
+// Set cpu affinity of the task.
+//
+// Binds the task to the cpus set in <cpus>, if handle is NULL, binds the 
+// calling task.  A task restarted keeps the affinity it was created with.
+// A task not running fails, tskCreateEx places a task before it starts.
+//
+// RETURNS: 0-success, otherwize ERROR.
+*/
+STATUS tskSetAffinity( HANDLE handle, UINT64 cpus )
+{
+	OSTask* pTask = (OSTask*)handle;
+	cpu_set_t set;
+
+	if (cpus == 0) return ERROR;
+	if ((pTask != NULL) && (pTask->tid == 0)) return ERROR;
+
+	tskCpuSet(&set, cpus);
+
+	return pthread_setaffinity_np((pTask == NULL) ? pthread_self() : pTask->tid, 
+	                              sizeof(set), &set) ? ERROR : OK;
+}
+
+/* 
+// Get cpu affinity of the task, if handle is NULL, of the calling task.
+// A task not running fails.
+//
+// RETURNS: 0-success, otherwize ERROR.
+*/
+STATUS tskGetAffinity( HANDLE handle, UINT64 *cpus )
+{
+	OSTask* pTask = (OSTask*)handle;
+	cpu_set_t set;
+	int cpu;
+
+	if (cpus == NULL) return ERROR;
+	if ((pTask != NULL) && (pTask->tid == 0)) return ERROR;
+
+	if (pthread_getaffinity_np((pTask == NULL) ? pthread_self() : pTask->tid, 
+	                           sizeof(set), &set))
+		return ERROR;
+
+	*cpus = 0;
+	for (cpu = 0; cpu < OSA_MAX_CPUS; cpu++)
+		if (CPU_ISSET(cpu, &set)) *cpus |= 1ULL << cpu;
+
+	return OK;
+}
+
+/* periodic release of the calling task */
+LOCAL __thread OSPeriod tskPeriod;
+
+/* 
+// Make the calling task periodic.
+//
+// The first release is one period from now, 0 stops the task being 
+// periodic.  The statistics are cleared.
+//
+// RETURNS: 0-success, otherwize ERROR.
+*/
+STATUS tskSetPeriod( UINT64 periodns )
+{
+	bfillBytes( (char*) &tskPeriod, sizeof (tskPeriod), 0 );
+	if (periodns == 0) return OK;
+
+	tskPeriod.period = periodns;
+	tskPeriod.next   = OSA_nowNs() + periodns;
+	tskPeriod.stats.period    = periodns;
+	tskPeriod.stats.jitterMin = ~0ULL;
+
+	return OK;
+}
+
+/* 
+// Wait for the next release of the calling task.
+//
+// Releases are absolute CLOCK_MONOTONIC times a whole number of periods
+// from the first one, so the time spent between waits never drifts the 
+// phase.  If the task comes late, the releases missed are counted as
+// overruns and skipped.  The lateness of every wakeup is the jitter.
+//
+// RETURNS: number of releases missed, or ERROR if not periodic.
+*/
+int tskWaitPeriod( void )
+{
+	struct timespec abstm;
+	UINT64 now, jitter, missed = 0;
+
+	if (tskPeriod.period == 0) return ERROR;
+
+	now = OSA_nowNs();
+	if (now >= tskPeriod.next)
+	{
+		missed = (now - tskPeriod.next) / tskPeriod.period + 1;
+		tskPeriod.next += missed * tskPeriod.period;
+		tskPeriod.stats.overruns += missed;
+	}
+
+	OSA_deadlineTime(&abstm, tskPeriod.next);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &abstm, NULL) == EINTR)
+		;
+
+	now    = OSA_nowNs();
+	jitter = (now > tskPeriod.next) ? (now - tskPeriod.next) : 0;
+	tskPeriod.stats.releases++;
+	tskPeriod.stats.jitterSum += jitter;
+	if (jitter < tskPeriod.stats.jitterMin) tskPeriod.stats.jitterMin = jitter;
+	if (jitter > tskPeriod.stats.jitterMax) tskPeriod.stats.jitterMax = jitter;
+	OSA_statWakeup( tskPeriod.next );
+
+	tskPeriod.next += tskPeriod.period;
+
+	return (int)missed;
+}
+
+/* 
+// Get release statistics of the calling task.
+//
+// RETURNS: 0-success, otherwize ERROR.
+*/
+STATUS tskGetPeriodStats( TSK_PERIOD_STATS *stats )
+{
+	if ((stats == NULL) || (tskPeriod.period == 0)) return ERROR;
+
+	*stats = tskPeriod.stats;
+	if (stats->releases == 0) stats->jitterMin = 0;
+
+	return OK;
+}
+
+/*
+// Get a counter of the "<name>: <value>" line of a proc status file.
+//
+// RETURNS: value of the counter, 0 if not found.
+*/
+LOCAL UINT64 tskProcCounter( const char *status, const char *name )
+{
+	const char *line = strstr(status, name);
+
+	if (line == NULL) return 0;
+
+	return strtoull(line + strlen(name), NULL, 10);
+}
+
+/*
+// Get the statistics of a task from the kernel.
+//
+// CPU time is read on the cpu clock of the thread, context switches and 
+// the run queue delay from its proc files.
+//
+// RETURNS: N/A.
+*/
+LOCAL void tskKernelStats( pthread_t tid, pid_t kid, TSK_STATS *stats )
+{
+	char path[64], buffer[2048];
+	struct timespec cputm;
+	clockid_t clock;
+
+	if (pthread_equal(tid, pthread_self()))
+		clock = CLOCK_THREAD_CPUTIME_ID;
+	else if (pthread_getcpuclockid(tid, &clock) != 0)
+		return;
+	if (clock_gettime(clock, &cputm) == 0)
+		stats->cpuTime = (UINT64)cputm.tv_sec * 1000000000ULL + (UINT64)cputm.tv_nsec;
+
+	snprintf(path, sizeof(path), "/proc/self/task/%d/status", (int)kid);
+	if (osaReadSysfs( path, buffer, sizeof(buffer) ) > 0)
+	{
+		stats->volSwitches   = tskProcCounter( buffer, "\nvoluntary_ctxt_switches:" );
+		stats->involSwitches = tskProcCounter( buffer, "nonvoluntary_ctxt_switches:" );
+	}
+
+	/* cpu time, run queue delay and number of timeslices */
+	snprintf(path, sizeof(path), "/proc/self/task/%d/schedstat", (int)kid);
+	if (osaReadSysfs( path, buffer, sizeof(buffer) ) > 0)
+		(void)sscanf(buffer, "%*u %llu", (unsigned long long*)&stats->runDelay);
+}
+
+/*
+// Copy the statistics the task accounts itself.
+//
+// RETURNS: N/A.
+*/
+LOCAL void tskOwnStats( OSTaskStats *pStats, TSK_STATS *stats )
+{
+	int bucket;
+
+	stats->blockedTime = __atomic_load_n(&pStats->blockedTime, __ATOMIC_RELAXED);
+	stats->blocks      = __atomic_load_n(&pStats->blocks, __ATOMIC_RELAXED);
+	stats->wakeups     = __atomic_load_n(&pStats->wakeups, __ATOMIC_RELAXED);
+	stats->latencyMax  = __atomic_load_n(&pStats->latencyMax, __ATOMIC_RELAXED);
+	for (bucket = 0; bucket < TSK_LATENCY_BUCKETS; bucket++)
+		stats->latency[bucket] = __atomic_load_n(&pStats->latency[bucket], __ATOMIC_RELAXED);
+}
+
+/* 
+// Get runtime statistics of the task, or of the calling task if handle 
+// is NULL.
+//
+// RETURNS: 0-success, otherwize ERROR.
+*/
+STATUS tskGetStats( HANDLE handle, TSK_STATS *stats )
+{
+	OSTask* pTask = (OSTask*)handle;
+
+	if (stats == NULL) return ERROR;
+
+	bfillBytes( (char*) stats, sizeof (*stats), 0 );
+
+	if (pTask == NULL)
+	{
+		(void)tskGetPriority( NULL, &stats->prio );
+		stats->id = (int)syscall(SYS_gettid);
+		tskKernelStats( pthread_self(), (pid_t)stats->id, stats );
+		tskOwnStats( osaStats(), stats );
+		return OK;
+	}
+
+	stats->stackSize = (UINT32)pTask->pStack->size;
+	stats->stackUsed = stkHighWater( pTask->pStack );
+	stats->id = (int)pTask->kid;
+	if ((pTask->tid != 0) && (stats->id != 0))
+	{
+		(void)tskGetPriority( handle, &stats->prio );
+		tskKernelStats( pTask->tid, pTask->kid, stats );
+	}
+	tskOwnStats( &pTask->stats, stats );
+
+	return OK;
+}
+
+/* 
+// Print runtime statistics of all tasks created.
+//
+// Times are in microseconds, stack sizes in bytes, the latency histogram
+// lists the non-empty buckets by their upper bound.
+//
+// RETURNS: N/A.
+*/
+void tskShowAll( void )
+{
+	TSK_STATS stats;
+	DL_NODE *pNode;
+	int bucket;
+
+	printf("%8s %4s %12s %9s %9s %12s %12s %9s %9s %9s %8s %8s\n", "ID", "PRI",
+	       "CPU", "VCSW", "ICSW", "RUNDELAY", "BLOCKED", "BLOCKS", "WAKEUPS", "LATMAX",
+	       "STACK", "USED");
+
+	pthread_mutex_lock(&tskListLock);
+	for (pNode = DLL_FIRST(&tskList); pNode != NULL; pNode = DLL_NEXT(pNode))
+	{
+		(void)tskGetStats( (HANDLE)pNode, &stats );
+		printf("%8d %4d %12llu %9llu %9llu %12llu %12llu %9llu %9llu %9llu %8u %8u\n", 
+		       stats.id, stats.prio,
+		       (unsigned long long)(stats.cpuTime / 1000),
+		       (unsigned long long)stats.volSwitches,
+		       (unsigned long long)stats.involSwitches,
+		       (unsigned long long)(stats.runDelay / 1000),
+		       (unsigned long long)(stats.blockedTime / 1000),
+		       (unsigned long long)stats.blocks,
+		       (unsigned long long)stats.wakeups,
+		       (unsigned long long)(stats.latencyMax / 1000),
+		       (unsigned)stats.stackSize, (unsigned)stats.stackUsed);
+
+		if (stats.wakeups == 0) continue;
+		printf("%8s latency", "");
+		for (bucket = 0; bucket < TSK_LATENCY_BUCKETS; bucket++)
+		{
+			if (stats.latency[bucket] == 0) continue;
+			if (bucket == TSK_LATENCY_BUCKETS - 1)
+				printf(" >=%llu:%llu", 1ULL << (bucket - 1), 
+				       (unsigned long long)stats.latency[bucket]);
+			else
+				printf(" <%llu:%llu", 1ULL << bucket, 
+				       (unsigned long long)stats.latency[bucket]);
+		}
+		printf("\n");
+	}
+	pthread_mutex_unlock(&tskListLock);
+}
+
+/*
+// Parse a sysfs cpu list such as "0-3,6,8-9" into a cpu mask.
+//
+// RETURNS: cpu mask, 0 if the list is empty.
+*/
+LOCAL UINT64 tskCpuList( const char *list )
+{
+	UINT64 cpus = 0;
+	char *end;
+	long first, last;
+
+	while (*list)
+	{
+		first = strtol(list, &end, 10);
+		if (end == list) break;
+		last = first;
+		list = end;
+		if (*list == '-')
+		{
+			last = strtol(list + 1, &end, 10);
+			list = end;
+		}
+		for (; (first <= last) && (first < OSA_MAX_CPUS); first++)
+			if (first >= 0) cpus |= 1ULL << first;
+		if (*list == ',') list++;
+	}
+
+	return cpus;
+}
+
+/*
+// Read a cpu list of sysfs as cpu mask.
+//
+// RETURNS: cpu mask, 0 if missing or empty.
+*/
+LOCAL UINT64 tskSysfsCpus( const char *path )
+{
+	char buffer[256];
+
+	if (osaReadSysfs( path, buffer, sizeof(buffer) ) <= 0) return 0;
+
+	return tskCpuList( buffer );
+}
+
+/*
+// Read a number of sysfs.
+//
+// RETURNS: the number, or -1 if missing.
+*/
+LOCAL int tskSysfsInt( const char *path )
+{
+	char buffer[32];
+
+	if (osaReadSysfs( path, buffer, sizeof(buffer) ) <= 0) return -1;
+
+	return atoi(buffer);
+}
+
+/* 
+// Get the cpu topology from sysfs.
+//
+// Isolated cores are those taken from the scheduler by isolcpus=, or
+// running tickless by nohz_full=; SCHED_FIFO tasks pinned there are not
+// disturbed by other tasks nor the scheduler tick.
+//
+// RETURNS: 0-success, otherwize ERROR.
+*/
+STATUS OSA_getCpuTopology( OSA_CPU_TOPOLOGY *topo )
+{
+	char path[128];
+	int cpu;
+
+	if (topo == NULL) return ERROR;
+
+	bfillBytes( (char*) topo, sizeof (*topo), 0 );
+
+	topo->online = tskSysfsCpus( "/sys/devices/system/cpu/online" );
+	if (topo->online == 0) return ERROR;
+	topo->isolated = tskSysfsCpus( "/sys/devices/system/cpu/isolated" );
+	topo->nohzFull = tskSysfsCpus( "/sys/devices/system/cpu/nohz_full" );
+
+	for (cpu = 0; cpu < OSA_MAX_CPUS; cpu++)
+	{
+		topo->coreId[cpu] = topo->packageId[cpu] = -1;
+		if (!(topo->online & (1ULL << cpu))) continue;
+
+		topo->nCpus++;
+		snprintf(path, sizeof(path), 
+		         "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+		topo->coreId[cpu] = tskSysfsInt( path );
+		snprintf(path, sizeof(path), 
+		         "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+		topo->packageId[cpu] = tskSysfsInt( path );
+	}
+
+	return OK;
+}
+
 /* 
 // Check if current thread is self.
 //
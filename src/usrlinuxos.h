@@ -16,27 +16,62 @@ modification history
 #include <errno.h>
 #include <rawtypes.h>
 #include <sllist.h>
+#include <dllist.h>
+#include <osa.h>
 #include <linux/param.h>
 
 /* osa common routines */
-extern void OSA_evalAbsTime( struct timespec *abstms, UINT32 tminms );
+extern void OSA_deadlineTime( struct timespec *abstms, UINT64 deadline );
+extern int  OSA_condInit( pthread_cond_t *pCond, int pshared );
+extern int  OSA_condWaitUntil( pthread_cond_t *pCond, pthread_mutex_t *pLock, UINT64 deadline );
 extern int  OSA_attachSigHandler( int sigid, void(*handler)(int) );
+extern int  OSA_futexWait( volatile INT32 *addr, INT32 val, UINT64 deadline );
+extern int  OSA_futexWake( volatile INT32 *addr, int count );
+extern int  OSA_spinBudget( BOOL adaptive, int spin );
+extern BOOL OSA_spinFor( volatile INT32 *addr, INT32 min, int spin, OSA_SPIN_STATS *pStats );
+extern void OSA_spinStats( OSA_SPIN_STATS *pStats, OSA_SPIN_STATS *stats );
+extern void OSA_statBlocked( UINT64 since );
+extern void OSA_statWakeup( UINT64 deadline );
+
+/* size of cache line, used to separate data written by different cpus */
+#define CACHE_LINE_SIZE 64
+
+/* hint to the cpu that the task is spinning */
+#if defined(__i386__) || defined(__x86_64__)
+#define OSA_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define OSA_CPU_RELAX() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define OSA_CPU_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
 
 /* osa event definition */
 typedef struct LinuxEvent
 {
-	UINT32          flag; /* event flag */
-	pthread_mutex_t lock; /* mutex object */
-	pthread_cond_t  cond; /* condition variable */
+	volatile INT32 state; /* event flag and pulse generation, futex word */
+	volatile INT32 waiters; /* number of tasks pending */
+	int          options; /* EVENT_OPT_XXX */
+	int             spin; /* spin rounds before pending, 0 if not adaptive */
+	OSA_SPIN_STATS spinStats; /* spin statistics */
 }
 OSEvent;
 
+/* osa event group definition */
+typedef struct LinuxEventGroup
+{
+	volatile INT32  bits; /* event flag bits, futex word */
+	volatile INT32 waiters; /* number of tasks pending */
+}
+OSEventGroup;
+
 /* definition of semaphore. */
 typedef struct LinuxSemaphore
 {
-	INT32          count; /* semaphore count */
-	pthread_mutex_t lock; /* mutex object */
-	pthread_cond_t  cond; /* condition variable */
+	volatile INT32 count; /* semaphore count, futex word */
+	volatile INT32 waiters; /* number of tasks pending */
+	volatile INT32 bigWaiters; /* number of tasks pending for several counts */
+	int             spin; /* spin rounds before pending, 0 if not adaptive */
+	OSA_SPIN_STATS spinStats; /* spin statistics */
 } 
 OSSemaphore;
 
@@ -44,32 +79,277 @@ OSSemaphore;
 typedef struct LinuxMutex
 {
 	pthread_mutex_t lock; /* mutex object */
+	int          options; /* MUTEX_OPT_XXX */
+	int             spin; /* lock retries before pending, 0 if not adaptive */
+	BOOL       ownerDied; /* previous owner died holding it, set by owner */
+	OSA_SPIN_STATS spinStats; /* spin statistics */
 }
 OSMutex;
+
+/* number of reader slots of a rwlock, tasks are spread over them */
+#define RWLOCK_SLOTS 32
+
+/* reader slot of a rwlock, each one owns a cache line */
+typedef struct LinuxRwSlot
+{
+	volatile INT32 readers; /* read locks held by tasks of this slot */
+	char  pad[CACHE_LINE_SIZE - sizeof(INT32)];
+}
+OSRwSlot;
+
+/* Defenition of reader-writer lock */
+typedef struct LinuxRwLock
+{
+	volatile INT32   writers; /* writers holding or waiting, futex word */
+	volatile INT32     owner; /* 1 if a writer holds the lock, futex word */
+	volatile INT32     drain; /* bumped by readers leaving, futex word */
+	volatile INT32 rdWaiters; /* number of readers pending on writers */
+	volatile INT32 wrWaiters; /* number of writers pending on owner */
+	char  pad[CACHE_LINE_SIZE - 5 * sizeof(INT32)];
+	OSRwSlot slots[RWLOCK_SLOTS]; /* per task reader counters */
+}
+OSRwLock;
+
+/* rcu reader of a task, registered at its first read section */
+typedef struct LinuxRcuReader
+{
+	DL_NODE          node; /* link of registered readers */
+	volatile UINT64   ctr; /* grace period at entering, 0 if outside */
+	int              nest; /* nesting depth of read sections */
+	char  pad[CACHE_LINE_SIZE - sizeof(DL_NODE) - sizeof(UINT64) - sizeof(int)];
+}
+OSRcuReader;
+
+/* rcu callback waiting for a grace period */
+typedef struct LinuxRcuHead
+{
+	SL_NODE          node; /* link of pending callbacks */
+	void (*func)(void*); /* callback routine */
+	void*             arg; /* callback argument */
+	UINT64             gp; /* grace period started by the callback */
+}
+OSRcuHead;
 
+/* Defenition of lock-free message ring */
+typedef struct LinuxMessageRing
+{
+	char  pad0[CACHE_LINE_SIZE]; /* keep read-mostly fields out of the way */
+	volatile UINT64       head; /* consumer index */
+	UINT64           tailCache; /* consumer's copy of tail, MQ_TYPE_SPSC */
+	char  pad1[CACHE_LINE_SIZE];
+	volatile UINT64       tail; /* producer index */
+	UINT64           headCache; /* producer's copy of head, MQ_TYPE_SPSC */
+	char  pad2[CACHE_LINE_SIZE];
+	volatile INT32     rdEvent; /* futex word pended by readers */
+	volatile INT32     wrEvent; /* futex word pended by writers */
+	volatile INT32   rdWaiters; /* number of readers pending */
+	volatile INT32   wrWaiters; /* number of writers pending */
+	char  pad3[CACHE_LINE_SIZE];
+	char*            slotPool; /* message slots */
+	UINT32               mask; /* number of slots - 1, power of two */
+	int              slotSize; /* bytes of every slot */
+	char  pad4[CACHE_LINE_SIZE];
+	volatile INT32   highWater; /* sampled high-water mark */
+}
+OSMessageRing;
+
+/* number of message priorities, MSG_PRI_NORMAL ... MSG_PRI_MAX */
+#define MSG_PRI_LANES 32
+
+/* offset list of shared message queue, 0 is the end of list */
+typedef struct LinuxShmList
+{
+	UINT32           head; /* offset of first node */
+	UINT32           tail; /* offset of last node */
+}
+OSShmList;
+
+/* Defenition of message queue in shared memory, nodes follow the header */
+typedef struct LinuxShmQueue
+{
+	volatile UINT32 magic; /* MQ_SHM_MAGIC once initialized */
+	UINT32           size; /* bytes of the shared region */
+	int	          maxMsgs; /* max number of messages in queue */
+	int	        maxMsgLen; /* max length of message */
+	int          nodeSize; /* bytes of every message node */
+	UINT32       nodeBase; /* offset of first message node */
+	pthread_mutex_t  lock; /* robust process-shared mutex */
+	pthread_cond_t condrd; /* condition variable for pending on reading */
+	pthread_cond_t condwr; /* condition variable for pending on writing */
+	int         rdWaiters; /* number of tasks pending on reading */
+	int         wrWaiters; /* number of tasks pending on writing */
+	UINT32       readyMap; /* bit set for every non-empty lane */
+	OSShmList qReady[MSG_PRI_LANES]; /* message queue heads, one per priority */
+	OSShmList       qFree; /* free message queue head */
+	MQ_STATS        stats; /* statistics, updated under lock */
+}
+OSShmQueue;
+
 /* Defenition of message queue */
 typedef struct LinuxMessageQueue
 {
-    SL_LIST        qReady; /* message queue head */
-    SL_LIST         qFree; /* free message queue head */
+    int              type; /* queue type, MQ_TYPE_XXX */
+    SL_LIST qReady[MSG_PRI_LANES]; /* message queue heads, one per priority */
+    UINT32       readyMap; /* bit set for every non-empty lane */
+    SL_LIST qFree[MQ_SIZE_CLASSES]; /* free message queue heads, one per size class */
+    int classLen[MQ_SIZE_CLASSES]; /* max length of message of every size class */
+    int          nClasses; /* number of size classes */
     void*         msgPool; /* messages pool */
     int	          maxMsgs; /* max number of messages in queue */
     int	        maxMsgLen; /* max length of message */
 	pthread_mutex_t  lock; /* mutex */
 	pthread_cond_t condrd; /* condition variable for pending on reading */
 	pthread_cond_t condwr; /* condition variable for pending on writing */
+	int         rdWaiters; /* number of tasks pending on reading */
+	int         wrWaiters; /* number of tasks pending on writing */
+	MQ_STATS        stats; /* statistics, updated under lock if not lock-free */
+	OSMessageRing    ring; /* lock-free ring of MQ_TYPE_SPSC/MPMC */
+	OSShmQueue*       shm; /* mapped queue of MQ_TYPE_SHARED */
+	volatile int      efd; /* eventfd of mqGetFd(), -1 if none */
+	volatile INT32 fdReadable; /* eventfd was written and not drained */
 } 
 OSMessageQueue;
 
 /* OSA task management */
+/* runtime statistics of a task, written only by the task itself */
+typedef struct LinuxTaskStats
+{
+	UINT64  blockedTime; /* nanoseconds blocked in osa primitives */
+	UINT64       blocks; /* number of times blocked */
+	UINT64      wakeups; /* number of timed wakeups */
+	UINT64   latencyMax; /* max lateness of timed wakeups */
+	UINT64 latency[TSK_LATENCY_BUCKETS]; /* lateness histogram */
+}
+OSTaskStats;
+
+/* task stack of the stack pool, a guard page below it */
+typedef struct LinuxStack
+{
+	DL_NODE      node; /* node in list of free or retired stacks */
+	char*        base; /* lowest address of the stack */
+	size_t       size; /* size of the stack, without the guard page */
+	pthread_t     tid; /* thread that exited on the stack, to be joined */
+}
+OSStack;
+
+/* number of free stacks the pool keeps */
+#define STACK_POOL_SIZE 16
+
+/* fill pattern of unused stack, for high-water measurement */
+#define STACK_PATTERN 0xa5a5a5a5
+
 typedef struct LinuxTask
 {
+	DL_NODE        node; /* node in list of tasks */
 	pthread_t       tid; /* task identifier */
 	pthread_attr_t attr; /* task attribute */
 	int (*entry)(void*); /* task entry routine */
 	PVOID         param; /* task parameters */
+	OSStack*     pStack; /* task stack */
+	volatile pid_t  kid; /* kernel thread id, 0 before started */
+	OSTaskStats   stats; /* runtime statistics */
 }
 OSTask;
+
+/* number of work priority lanes of a thread pool */
+#define TPOOL_LANES 4
+
+/* work item of thread pool */
+typedef struct LinuxPoolWork
+{
+	void (*func)(void*); /* work routine */
+	void*             arg; /* work routine argument */
+	int              prio; /* task priority to run at */
+}
+OSPoolWork;
+
+/* Chase-Lev work-stealing deque, pushed and taken by the owner at bottom */
+typedef struct LinuxPoolDeque
+{
+	volatile INT64    top; /* thieves steal here */
+	char  pad0[CACHE_LINE_SIZE - sizeof(INT64)];
+	volatile INT64 bottom; /* owner pushes and takes here */
+	char  pad1[CACHE_LINE_SIZE - sizeof(INT64)];
+	OSPoolWork*     slots; /* ring of work items */
+	INT64            mask; /* number of slots - 1, power of two */
+}
+OSPoolDeque;
+
+struct LinuxPool;
+
+/* worker task of thread pool */
+typedef struct LinuxPoolWorker
+{
+	OSPoolDeque deques[TPOOL_LANES]; /* own work, one deque per lane */
+	struct LinuxPool *pPool; /* owner pool */
+	HANDLE           task; /* worker task */
+	int             index; /* index in pool */
+	int              prio; /* current task priority */
+	UINT32           seed; /* victim selection */
+}
+OSPoolWorker;
+
+/* Defenition of thread pool */
+typedef struct LinuxPool
+{
+	int          nWorkers; /* number of worker tasks */
+	int              prio; /* default task priority of work */
+	int            priMin; /* TASK_PRI_MIN */
+	int            priMax; /* TASK_PRI_MAX */
+	UINT64           cpus; /* cpus workers run on, 0 if any */
+	HANDLE inbox[TPOOL_LANES]; /* MQ_TYPE_MPMC queues for work from outside */
+	OSPoolWorker* workers; /* worker tasks */
+	char  pad0[CACHE_LINE_SIZE];
+	volatile INT32   idle; /* number of workers going to sleep */
+	volatile INT32 signal; /* bumped for sleeping workers, futex word */
+	volatile INT32   stop; /* set when the pool is deleted */
+	volatile INT32  alive; /* number of workers running, futex word */
+}
+OSPool;
+
+/* timing wheel of timer service, TIMER_LEVELS levels of TIMER_SLOTS slots */
+#define TIMER_TICK_NS 1000000ULL /* 1ms */
+#define TIMER_BITS    8
+#define TIMER_SLOTS   (1 << TIMER_BITS)
+#define TIMER_LEVELS  4
+
+/* Defenition of timer */
+typedef struct LinuxTimer
+{
+	DL_NODE          node; /* link of wheel slot */
+	void (*func)(void*); /* expiry routine */
+	void*             arg; /* expiry routine argument */
+	UINT64        expires; /* tick to expire at */
+	UINT64         period; /* ticks of period, 0 if one-shot */
+	DL_LIST*        pSlot; /* list linked in, NULL if not started */
+	BOOL          deleted; /* deleted by its own expiry routine */
+}
+OSTimer;
+
+/* Defenition of timer service */
+typedef struct LinuxTimerWheel
+{
+	pthread_mutex_t  lock; /* protects wheel and timers */
+	pthread_cond_t   cond; /* signaled when a running routine returns */
+	DL_LIST wheel[TIMER_LEVELS][TIMER_SLOTS]; /* timer slots */
+	UINT64           base; /* monotonic time of tick 0 */
+	UINT64            now; /* next tick to process */
+	UINT64          armed; /* tick timerfd expires at, 0 if disarmed */
+	int          nPending; /* number of timers started */
+	int               tfd; /* timerfd driving the wheel */
+	HANDLE           task; /* timer task */
+	OSTimer*     pRunning; /* timer whose routine is running */
+}
+OSTimerWheel;
+
+/* periodic release of a task */
+typedef struct LinuxPeriod
+{
+	UINT64         period; /* nanoseconds, 0 if not periodic */
+	UINT64           next; /* CLOCK_MONOTONIC time of next release */
+	TSK_PERIOD_STATS stats; /* release statistics */
+}
+OSPeriod;
 
 /* OSA task max & min priority current supported. */
 #define TASK_PRI_MAX sched_get_priority_max(SCHED_FIFO)
@@ -81,6 +361,9 @@ OSTask;
 /* OSA task default stack size. */
 #define TASK_STACKSIZE_DEFAULT 0
 
+/* size of stack of tasks created with the default stack size */
+#define TASK_STACKSIZE_POOL (256*1024)
+
 #endif /*__LINUXOS_H*/
 
 /*
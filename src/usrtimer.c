@@ -0,0 +1,389 @@
+/* usrtimer.c - OSA timer service */
+
+/*
+modification history
+--------------------
+1.00, 2026-10-17, initial
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/timerfd.h>
+#include <bufops.h>
+#include <osa.h>
+#include "usrlinuxos.h"
+
+/*
+// Timers are kept in a hierarchical timing wheel.  A timer due within
+// TIMER_SLOTS ticks is linked in the slot of its tick at level 0, later
+// ones in coarser slots of higher levels, and are cascaded down as the
+// wheel turns, so that starting and cancelling are O(1).  A single task
+// sleeps on a timerfd until the next tick with work, and runs the expiry
+// routines; they should be short.
+*/
+
+LOCAL OSTimerWheel timerWheel;
+LOCAL pthread_once_t timerOnce = PTHREAD_ONCE_INIT;
+LOCAL STATUS timerInitStatus = ERROR;
+
+/*
+// Get the current tick.
+//
+// RETURNS: ticks since the timer service started.
+*/
+LOCAL UINT64 timerTickNow( void )
+{
+	return (OSA_nowNs() - timerWheel.base) / TIMER_TICK_NS;
+}
+
+/*
+// Link a timer in the slot of its expiry tick, under lock.
+//
+// RETURNS: N/A.
+*/
+LOCAL void timerLink( OSTimer *pTimer )
+{
+	UINT64 expires = pTimer->expires;
+	UINT64 delta;
+	int level;
+
+	/* overdue timers expire at the next tick processed */
+	if (expires < timerWheel.now) expires = timerWheel.now;
+
+	delta = expires - timerWheel.now;
+	for (level = 0; level < TIMER_LEVELS - 1; level++)
+		if (delta < (1ULL << (TIMER_BITS * (level + 1)))) break;
+
+	/* beyond the wheel, parked in the farthest slot and cascaded again */
+	if (delta >= (1ULL << (TIMER_BITS * TIMER_LEVELS)))
+		expires = timerWheel.now + (1ULL << (TIMER_BITS * TIMER_LEVELS)) - 1;
+
+	pTimer->pSlot = &timerWheel.wheel[level]
+	                [(expires >> (TIMER_BITS * level)) & (TIMER_SLOTS - 1)];
+	dllAdd(pTimer->pSlot, &pTimer->node);
+}
+
+/*
+// Unlink a started timer, under lock.
+//
+// RETURNS: N/A.
+*/
+LOCAL void timerUnlink( OSTimer *pTimer )
+{
+	dllRemove(pTimer->pSlot, &pTimer->node);
+	pTimer->pSlot = NULL;
+	timerWheel.nPending--;
+}
+
+/*
+// Arm the timerfd to expire at <tick>, or disarm it if 0, under lock.
+//
+// RETURNS: N/A.
+*/
+LOCAL void timerArm( UINT64 tick )
+{
+	struct itimerspec its;
+
+	bfillBytes( (char*) &its, sizeof (its), 0 );
+	if (tick != 0)
+		OSA_deadlineTime(&its.it_value, timerWheel.base + tick * TIMER_TICK_NS);
+
+	timerWheel.armed = tick;
+	(void)timerfd_settime(timerWheel.tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/*
+// Get the next tick the wheel has to be turned at, under lock.
+//
+// It is the next non-empty slot of level 0, or the next cascade of
+// higher levels.
+//
+// RETURNS: tick, or 0 if no timer is started.
+*/
+LOCAL UINT64 timerNextTick( void )
+{
+	UINT64 tick;
+
+	if (timerWheel.nPending == 0) return 0;
+
+	for (tick = timerWheel.now; ; tick++)
+	{
+		if (((tick & (TIMER_SLOTS - 1)) == 0) ||
+		    !DLL_EMPTY(&timerWheel.wheel[0][tick & (TIMER_SLOTS - 1)]))
+			return tick;
+	}
+}
+
+/*
+// Move the timers of the current slot of <level> down, under lock.
+//
+// RETURNS: index of the slot cascaded.
+*/
+LOCAL int timerCascade( int level )
+{
+	int index = (int)((timerWheel.now >> (TIMER_BITS * level)) & (TIMER_SLOTS - 1));
+	DL_LIST *pSlot = &timerWheel.wheel[level][index];
+	OSTimer *pTimer;
+
+	while ((pTimer = (OSTimer*)dllGet(pSlot)) != NULL)
+		timerLink( pTimer );
+
+	return index;
+}
+
+/*
+// Process the current tick, and step to the next one, under lock.
+//
+// The routines of expired timers run out of lock, a periodic timer is
+// linked again before its routine runs, so that the routine may cancel it.
+//
+// RETURNS: N/A.
+*/
+LOCAL void timerStep( void )
+{
+	DL_LIST expired;
+	OSTimer *pTimer;
+	UINT64 tick = timerWheel.now;
+	int level;
+
+	/* cascade higher levels at every turn of the level below */
+	for (level = 1; level < TIMER_LEVELS; level++)
+	{
+		if ((tick & ((1ULL << (TIMER_BITS * level)) - 1)) != 0) break;
+		timerCascade( level );
+	}
+
+	dllInit(&expired);
+	while ((pTimer = (OSTimer*)dllGet(
+	            &timerWheel.wheel[0][tick & (TIMER_SLOTS - 1)])) != NULL)
+	{
+		pTimer->pSlot = &expired;
+		dllAdd(&expired, &pTimer->node);
+	}
+	timerWheel.now = tick + 1;
+
+	while ((pTimer = (OSTimer*)dllGet(&expired)) != NULL)
+	{
+		pTimer->pSlot = NULL;
+		timerWheel.nPending--;
+
+		if (pTimer->period != 0)
+		{
+			pTimer->expires += pTimer->period;
+			if (pTimer->expires <= tick) pTimer->expires = tick + pTimer->period;
+			timerLink( pTimer );
+			timerWheel.nPending++;
+		}
+
+		timerWheel.pRunning = pTimer;
+		pthread_mutex_unlock(&timerWheel.lock);
+		pTimer->func( pTimer->arg );
+		pthread_mutex_lock(&timerWheel.lock);
+		timerWheel.pRunning = NULL;
+
+		if (pTimer->deleted)
+			MEMDEL( pTimer );
+		pthread_cond_broadcast(&timerWheel.cond);
+	}
+}
+
+/*
+// Timer task entry.
+//
+// RETURNS: never.
+*/
+LOCAL int timerTask( void *arg )
+{
+	UINT64 expirations, now;
+
+	(void)arg;
+
+	for (;;)
+	{
+		(void)read(timerWheel.tfd, &expirations, sizeof(expirations));
+
+		pthread_mutex_lock(&timerWheel.lock);
+		now = timerTickNow();
+		while (timerWheel.now <= now)
+		{
+			/* nothing started, skip the idle ticks */
+			if (timerWheel.nPending == 0)
+			{
+				timerWheel.now = now + 1;
+				break;
+			}
+			timerStep();
+		}
+		timerArm( timerNextTick() );
+		pthread_mutex_unlock(&timerWheel.lock);
+	}
+
+	return 0;
+}
+
+/*
+// Start the timer service once.
+//
+// RETURNS: N/A.
+*/
+LOCAL void timerInit( void )
+{
+	int level, index;
+
+	if (pthread_mutex_init(&timerWheel.lock, NULL)) return;
+	if (OSA_condInit(&timerWheel.cond, 0)) return;
+
+	for (level = 0; level < TIMER_LEVELS; level++)
+		for (index = 0; index < TIMER_SLOTS; index++)
+			dllInit(&timerWheel.wheel[level][index]);
+
+	timerWheel.base = OSA_nowNs();
+	timerWheel.tfd  = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (timerWheel.tfd < 0) return;
+
+	timerWheel.task = tskSpawn( TASK_PRI_DEFAULT, TASK_STACKSIZE_DEFAULT,
+	                            timerTask, NULL );
+	if (timerWheel.task == NULL)
+	{
+		close(timerWheel.tfd);
+		return;
+	}
+
+	timerInitStatus = OK;
+}
+
+/*
+// Wait for the routine of a timer to return, under lock.
+//
+// Returns at once in the timer task, a routine may cancel its own timer.
+//
+// RETURNS: TRUE if the routine is not running, FALSE in its own routine.
+*/
+LOCAL BOOL timerSync( OSTimer *pTimer )
+{
+	if (tskSelf( timerWheel.task ))
+		return (timerWheel.pRunning != pTimer);
+
+	while (timerWheel.pRunning == pTimer)
+		pthread_cond_wait(&timerWheel.cond, &timerWheel.lock);
+
+	return TRUE;
+}
+
+/*
+// timerCreate - create a timer
+//
+// The routine <func> is called with <arg> in the timer task every time
+// the timer expires.
+//
+// RETURNS: Handle to timer, or NULL if failed.
+*/
+HANDLE timerCreate( void (*func)(void*), void *arg )
+{
+	OSTimer *pTimer;
+
+	if (func == NULL) return (NULL);
+
+	pthread_once(&timerOnce, timerInit);
+	if (timerInitStatus != OK) return (NULL);
+
+	pTimer = (OSTimer*)MEMNEW(sizeof(OSTimer));
+	if (pTimer == NULL) return (NULL);
+
+	bfillBytes( (char*) pTimer, sizeof (*pTimer), 0 );
+	pTimer->func = func;
+	pTimer->arg  = arg;
+
+	return (HANDLE)pTimer;
+}
+
+/*
+// timerDelete - cancel and delete a timer
+//
+// Waits for a running routine of the timer to return, unless called by
+// the routine itself, then the timer is released when it returns.
+//
+// RETURNS: N/A.
+*/
+void timerDelete( HANDLE handle )
+{
+	OSTimer *pTimer = (OSTimer*)handle;
+
+	if (pTimer == NULL) return;
+
+	pthread_mutex_lock(&timerWheel.lock);
+	if (pTimer->pSlot != NULL) timerUnlink( pTimer );
+	if (!timerSync( pTimer ))
+	{
+		pTimer->deleted = TRUE;
+		pTimer = NULL;
+	}
+	pthread_mutex_unlock(&timerWheel.lock);
+
+	if (pTimer != NULL) MEMDEL( pTimer );
+}
+
+/*
+// timerStart - start a timer
+//
+// The timer expires after <delayms> milliseconds, and then every
+// <periodms> milliseconds if <periodms> is not 0.  A started timer is
+// restarted.
+//
+// RETURNS: OK-success, otherwize ERROR
+*/
+STATUS timerStart( HANDLE handle, int delayms, int periodms )
+{
+	OSTimer *pTimer = (OSTimer*)handle;
+	UINT64 ticksPerMs = 1000000ULL / TIMER_TICK_NS;
+
+	if ((pTimer == NULL) || (delayms < 0) || (periodms < 0)) return ERROR;
+
+	pthread_mutex_lock(&timerWheel.lock);
+	if (pTimer->pSlot != NULL) timerUnlink( pTimer );
+
+	/* the wheel stood still while idle, catch up before linking */
+	if ((timerWheel.nPending == 0) && (timerTickNow() > timerWheel.now))
+		timerWheel.now = timerTickNow();
+
+	/* at least one full tick from now */
+	pTimer->expires = timerTickNow() + (UINT64)delayms * ticksPerMs + 1;
+	pTimer->period  = (UINT64)periodms * ticksPerMs;
+	timerLink( pTimer );
+	timerWheel.nPending++;
+
+	/* wake the timer task earlier if needed */
+	if ((timerWheel.armed == 0) || (pTimer->expires < timerWheel.armed))
+		timerArm( (pTimer->expires > timerWheel.now) ? pTimer->expires : timerWheel.now );
+	pthread_mutex_unlock(&timerWheel.lock);
+
+	return OK;
+}
+
+/*
+// timerCancel - cancel a timer
+//
+// Waits for a running routine of the timer to return, unless called by
+// the routine itself.
+//
+// RETURNS: OK if the timer was started, otherwize ERROR
+*/
+STATUS timerCancel( HANDLE handle )
+{
+	OSTimer *pTimer = (OSTimer*)handle;
+	BOOL started;
+
+	if (pTimer == NULL) return ERROR;
+
+	pthread_mutex_lock(&timerWheel.lock);
+	started = (pTimer->pSlot != NULL);
+	if (started) timerUnlink( pTimer );
+	(void)timerSync( pTimer );
+	pthread_mutex_unlock(&timerWheel.lock);
+
+	return started ? OK : ERROR;
+}
+
+/*
+// End of file
+*/
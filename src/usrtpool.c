@@ -0,0 +1,421 @@
+/* usrtpool.c - OSA work-stealing thread pool */
+
+/*
+modification history
+--------------------
+1.00, 2026-10-17, initial
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <bufops.h>
+#include <osa.h>
+#include "usrlinuxos.h"
+
+/*
+// Worker tasks push work of their own to their deques, and take it back
+// LIFO while it is warm in cache.  Work from other tasks goes through a
+// lock-free MQ_TYPE_MPMC inbox per lane.  An idle worker steals FIFO from
+// the deques of the others before it sleeps, so there is no lock shared
+// by all workers on the way of a work item.
+*/
+
+/* worker of the calling task, NULL if it is no pool worker */
+LOCAL __thread OSPoolWorker *tpoolSelf = NULL;
+
+/*
+// Push a work item at the bottom of the deque, by the owner only.
+//
+// RETURNS: TRUE if pushed, FALSE if the deque is full.
+*/
+LOCAL BOOL tpoolPush( OSPoolDeque *pDeque, const OSPoolWork *pWork )
+{
+	INT64 b = __atomic_load_n(&pDeque->bottom, __ATOMIC_RELAXED);
+	INT64 t = __atomic_load_n(&pDeque->top, __ATOMIC_ACQUIRE);
+	OSPoolWork *pSlot;
+
+	if (b - t > pDeque->mask) return FALSE;
+
+	pSlot = &pDeque->slots[b & pDeque->mask];
+	__atomic_store_n(&pSlot->func, pWork->func, __ATOMIC_RELAXED);
+	__atomic_store_n(&pSlot->arg,  pWork->arg,  __ATOMIC_RELAXED);
+	__atomic_store_n(&pSlot->prio, pWork->prio, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&pDeque->bottom, b + 1, __ATOMIC_RELAXED);
+
+	return TRUE;
+}
+
+/*
+// Take a work item from the bottom of the deque, by the owner only.
+//
+// RETURNS: TRUE if taken, FALSE if the deque is empty.
+*/
+LOCAL BOOL tpoolTake( OSPoolDeque *pDeque, OSPoolWork *pWork )
+{
+	INT64 b = __atomic_load_n(&pDeque->bottom, __ATOMIC_RELAXED) - 1;
+	INT64 t;
+	BOOL taken = TRUE;
+
+	__atomic_store_n(&pDeque->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	t = __atomic_load_n(&pDeque->top, __ATOMIC_RELAXED);
+
+	if (t > b)
+	{
+		/* empty */
+		__atomic_store_n(&pDeque->bottom, b + 1, __ATOMIC_RELAXED);
+		return FALSE;
+	}
+
+	*pWork = pDeque->slots[b & pDeque->mask];
+
+	/* the last item, race against thieves for it */
+	if (t == b)
+	{
+		taken = __atomic_compare_exchange_n(&pDeque->top, &t, t + 1, FALSE,
+		                                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+		__atomic_store_n(&pDeque->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+
+	return taken;
+}
+
+/*
+// Steal a work item from the top of the deque of another worker.
+//
+// RETURNS: TRUE if stolen, FALSE if the deque is empty or the race is lost.
+*/
+LOCAL BOOL tpoolSteal( OSPoolDeque *pDeque, OSPoolWork *pWork )
+{
+	INT64 t = __atomic_load_n(&pDeque->top, __ATOMIC_ACQUIRE);
+	INT64 b;
+	OSPoolWork *pSlot;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	b = __atomic_load_n(&pDeque->bottom, __ATOMIC_ACQUIRE);
+	if (t >= b) return FALSE;
+
+	/* the slot is not reused before top moves on, a torn copy is dropped */
+	pSlot = &pDeque->slots[t & pDeque->mask];
+	pWork->func = __atomic_load_n(&pSlot->func, __ATOMIC_RELAXED);
+	pWork->arg  = __atomic_load_n(&pSlot->arg,  __ATOMIC_RELAXED);
+	pWork->prio = __atomic_load_n(&pSlot->prio, __ATOMIC_RELAXED);
+
+	return __atomic_compare_exchange_n(&pDeque->top, &t, t + 1, FALSE,
+	                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+/*
+// Get the lane of a task priority, higher priorities get higher lanes.
+//
+// RETURNS: lane index.
+*/
+LOCAL int tpoolLane( OSPool *pPool, int prio )
+{
+	return (prio - pPool->priMin) * TPOOL_LANES / (pPool->priMax - pPool->priMin + 1);
+}
+
+/*
+// Find a work item for the worker, from the highest lane down: own deque
+// first, then the inbox, then the deques of the others.
+//
+// RETURNS: TRUE if found, otherwize FALSE
+*/
+LOCAL BOOL tpoolFind( OSPoolWorker *pWorker, OSPoolWork *pWork )
+{
+	OSPool *pPool = pWorker->pPool;
+	int lane, i, victim;
+
+	for (lane = TPOOL_LANES - 1; lane >= 0; lane--)
+	{
+		if (tpoolTake( &pWorker->deques[lane], pWork )) return TRUE;
+
+		if (mqReceive( pPool->inbox[lane], (char*)pWork, sizeof(*pWork), 0 )
+		    == sizeof(*pWork))
+			return TRUE;
+
+		/* xorshift, so that thieves do not line up on the same victim */
+		pWorker->seed ^= pWorker->seed << 13;
+		pWorker->seed ^= pWorker->seed >> 17;
+		pWorker->seed ^= pWorker->seed << 5;
+		victim = (int)(pWorker->seed % (UINT32)pPool->nWorkers);
+
+		for (i = 0; i < pPool->nWorkers; i++, victim++)
+		{
+			if (victim == pPool->nWorkers) victim = 0;
+			if (victim == pWorker->index) continue;
+			if (tpoolSteal( &pPool->workers[victim].deques[lane], pWork ))
+				return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/*
+// Wake up a sleeping worker after work is queued, if any.
+//
+// RETURNS: N/A.
+*/
+LOCAL void tpoolSignal( OSPool *pPool )
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&pPool->idle, __ATOMIC_RELAXED) > 0)
+	{
+		__atomic_add_fetch(&pPool->signal, 1, __ATOMIC_SEQ_CST);
+		OSA_futexWake(&pPool->signal, 1);
+	}
+}
+
+/*
+// Run a work item at its task priority.
+//
+// RETURNS: N/A.
+*/
+LOCAL void tpoolRun( OSPoolWorker *pWorker, OSPoolWork *pWork )
+{
+	if (pWork->prio != pWorker->prio)
+	{
+		(void)tskSetPriority( NULL, pWork->prio );
+		pWorker->prio = pWork->prio;
+	}
+
+	pWork->func( pWork->arg );
+}
+
+/*
+// Worker task entry.
+//
+// An idle worker counts itself before it looks for work the last time,
+// so that a task queueing work either is seen by the look, or finds the
+// worker and wakes it up.  Work left at deletion is done before exiting.
+//
+// RETURNS: 0.
+*/
+LOCAL int tpoolWorker( void *arg )
+{
+	OSPoolWorker *pWorker = (OSPoolWorker*)arg;
+	OSPool *pPool = pWorker->pPool;
+	OSPoolWork work;
+	INT32 signal;
+	BOOL found;
+
+	tpoolSelf = pWorker;
+	if (pPool->cpus != 0) (void)tskSetAffinity( NULL, pPool->cpus );
+
+	for (;;)
+	{
+		found = tpoolFind( pWorker, &work );
+		if (!found)
+		{
+			__atomic_add_fetch(&pPool->idle, 1, __ATOMIC_SEQ_CST);
+			signal = __atomic_load_n(&pPool->signal, __ATOMIC_SEQ_CST);
+
+			found = tpoolFind( pWorker, &work );
+			if (!found)
+			{
+				if (__atomic_load_n(&pPool->stop, __ATOMIC_SEQ_CST))
+				{
+					__atomic_sub_fetch(&pPool->idle, 1, __ATOMIC_RELAXED);
+					break;
+				}
+				OSA_futexWait(&pPool->signal, signal, DEADLINE_FOREVER);
+			}
+			__atomic_sub_fetch(&pPool->idle, 1, __ATOMIC_RELAXED);
+		}
+
+		if (found) tpoolRun( pWorker, &work );
+	}
+
+	tpoolSelf = NULL;
+	__atomic_sub_fetch(&pPool->alive, 1, __ATOMIC_SEQ_CST);
+	OSA_futexWake(&pPool->alive, INT32_MAX);
+
+	return 0;
+}
+
+/*
+// Stop the workers after the work queued, and release the pool.
+//
+// RETURNS: N/A.
+*/
+LOCAL void tpoolDestroy( OSPool *pPool )
+{
+	INT32 alive;
+	int i, lane;
+
+	__atomic_store_n(&pPool->stop, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&pPool->signal, 1, __ATOMIC_SEQ_CST);
+	OSA_futexWake(&pPool->signal, INT32_MAX);
+
+	/* workers never get cancelled in the middle of a work item */
+	while ((alive = __atomic_load_n(&pPool->alive, __ATOMIC_SEQ_CST)) > 0)
+		OSA_futexWait(&pPool->alive, alive, DEADLINE_FOREVER);
+
+	if (pPool->workers != NULL)
+	{
+		for (i = 0; i < pPool->nWorkers; i++)
+		{
+			if (pPool->workers[i].task != NULL)
+				(void)tskDelete( pPool->workers[i].task );
+			for (lane = 0; lane < TPOOL_LANES; lane++)
+				if (pPool->workers[i].deques[lane].slots != NULL)
+					MEMDEL( pPool->workers[i].deques[lane].slots );
+		}
+		MEMDEL( pPool->workers );
+	}
+
+	for (lane = 0; lane < TPOOL_LANES; lane++)
+		if (pPool->inbox[lane] != NULL) mqDelete( pPool->inbox[lane] );
+
+	MEMDEL( pPool );
+}
+
+/*
+// tpoolCreate - create a thread pool
+//
+// Spawns <workers> tasks at priority <prio> once, bound to the cpus set
+// in <cpus> if not 0.  Every deque and inbox holds <depth> work items per
+// lane, rounded up to a power of two.
+//
+// RETURNS: Handle to thread pool, or NULL if failed.
+*/
+HANDLE tpoolCreate( int workers, int prio, int depth, UINT64 cpus )
+{
+	OSPool *pPool;
+	OSPoolDeque *pDeque;
+	INT64 slots = 1;
+	int i, lane;
+
+	if ((workers <= 0) || (depth <= 0)) return (NULL);
+
+	pPool = (OSPool*)MEMNEW(sizeof(OSPool));
+	if (pPool == NULL) return (NULL);
+
+	bfillBytes( (char*) pPool, sizeof (*pPool), 0 );
+	pPool->priMin = TASK_PRI_MIN;
+	pPool->priMax = TASK_PRI_MAX;
+	if (prio > pPool->priMax) prio = pPool->priMax;
+	if (prio < pPool->priMin) prio = pPool->priMin;
+	pPool->prio = prio;
+	pPool->cpus = cpus;
+
+	while (slots < depth) slots <<= 1;
+
+	for (lane = 0; lane < TPOOL_LANES; lane++)
+	{
+		pPool->inbox[lane] = mqCreateEx( (int)slots, sizeof(OSPoolWork), MQ_TYPE_MPMC );
+		if (pPool->inbox[lane] == NULL) goto create_failed;
+	}
+
+	pPool->workers = (OSPoolWorker*)MEMNEW(sizeof(OSPoolWorker) * workers);
+	if (pPool->workers == NULL) goto create_failed;
+	bfillBytes( (char*) pPool->workers, sizeof(OSPoolWorker) * workers, 0 );
+
+	for (i = 0; i < workers; i++)
+	{
+		pPool->workers[i].pPool = pPool;
+		pPool->workers[i].index = i;
+		pPool->workers[i].prio  = prio;
+		pPool->workers[i].seed  = 2463534242U + (UINT32)i * 2654435761U;
+		for (lane = 0; lane < TPOOL_LANES; lane++)
+		{
+			pDeque = &pPool->workers[i].deques[lane];
+			pDeque->mask  = slots - 1;
+			pDeque->slots = (OSPoolWork*)MEMNEW(sizeof(OSPoolWork) * slots);
+			if (pDeque->slots == NULL) goto create_failed;
+		}
+	}
+
+	/* all deques exist before any worker looks for work to steal */
+	pPool->nWorkers = workers;
+	for (i = 0; i < workers; i++)
+	{
+		__atomic_add_fetch(&pPool->alive, 1, __ATOMIC_SEQ_CST);
+		pPool->workers[i].task = tskSpawn( prio, TASK_STACKSIZE_DEFAULT,
+		                                   tpoolWorker, &pPool->workers[i] );
+		if (pPool->workers[i].task == NULL)
+		{
+			__atomic_sub_fetch(&pPool->alive, 1, __ATOMIC_SEQ_CST);
+			goto create_failed;
+		}
+	}
+
+	return (HANDLE)pPool;
+
+create_failed:
+	if (pPool->nWorkers == 0) pPool->nWorkers = workers;
+	tpoolDestroy( pPool );
+	return (NULL);
+}
+
+/*
+// tpoolDelete - delete a thread pool
+//
+// Work queued before is done, then the workers exit.  It must not be
+// called by a worker of the pool.
+//
+// RETURNS: N/A.
+*/
+void tpoolDelete( HANDLE handle )
+{
+	OSPool *pPool = (OSPool*)handle;
+
+	if ((pPool == NULL) || ((tpoolSelf != NULL) && (tpoolSelf->pPool == pPool)))
+		return;
+
+	tpoolDestroy( pPool );
+}
+
+/*
+// tpoolSubmit - queue a work item to a thread pool
+//
+// A worker of the pool pushes to its own deque, other tasks to the inbox
+// of the lane.  <prio> is a task priority the work runs at, 0 for the
+// priority of the pool; higher priorities are also picked up first.  A
+// worker runs the work itself if both its deque and the inbox are full.
+//
+// RETURNS: OK-success, or ERROR if the pool is full.
+*/
+STATUS tpoolSubmit( HANDLE handle, void (*func)(void*), void *arg, int prio )
+{
+	OSPool *pPool = (OSPool*)handle;
+	OSPoolWorker *pWorker = tpoolSelf;
+	OSPoolWork work;
+	int lane;
+
+	if ((pPool == NULL) || (func == NULL)) return ERROR;
+
+	if (prio == 0) prio = pPool->prio;
+	if (prio > pPool->priMax) prio = pPool->priMax;
+	if (prio < pPool->priMin) prio = pPool->priMin;
+
+	work.func = func;
+	work.arg  = arg;
+	work.prio = prio;
+	lane = tpoolLane( pPool, prio );
+
+	if ((pWorker != NULL) && (pWorker->pPool == pPool))
+	{
+		if (!tpoolPush( &pWorker->deques[lane], &work ) &&
+		    (mqSend( pPool->inbox[lane], (char*)&work, sizeof(work), 0, 0 ) != sizeof(work)))
+		{
+			tpoolRun( pWorker, &work );
+			return OK;
+		}
+	}
+	else if (mqSend( pPool->inbox[lane], (char*)&work, sizeof(work), 0, 0 ) != sizeof(work))
+	{
+		return ERROR;
+	}
+
+	tpoolSignal( pPool );
+
+	return OK;
+}
+
+/*
+// End of file
+*/